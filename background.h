@@ -0,0 +1,35 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include "event_loop.h"
+#include "thread_pool.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Runs work on pool without blocking loop, then hands its result to apply on the loop thread. version is read on the
+// loop thread when the job is submitted and again when its result arrives; the result is discarded if token was
+// cancelled or the version has changed in between, since it was computed from data which no longer exists.
+template <typename Result>
+void run_in_background(ThreadPool& pool, EventLoop& loop, const CancellationToken& token,
+                       std::function<uint64_t()> version, std::function<Result(const CancellationToken&)> work,
+                       std::function<void(Result&)> apply)
+{
+    uint64_t submitted = version();
+    pool.submit([&loop, token, version, submitted, work, apply] {
+        if (token.cancelled())
+            return;
+
+        auto result = std::make_shared<Result>(work(token));
+        if (token.cancelled())
+            return;
+
+        loop.post([token, version, submitted, apply, result] {
+            if (token.cancelled() || version() != submitted)
+                return;
+            apply(*result);
+        });
+    });
+}
+
+#endif
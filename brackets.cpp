@@ -0,0 +1,682 @@
+#include "brackets.h"
+#include <algorithm>
+
+// Maximum number of blocks in a leaf and of children in an internal node
+static const size_t MAX_ENTRIES = 64;
+
+static bool starts_char(char c)
+{
+    return ((unsigned char)c & 0xC0) != 0x80;
+}
+
+static size_t count_chars(std::string_view text)
+{
+    return std::count_if(text.begin(), text.end(), starts_char);
+}
+
+// Returns the offset of the character at column, or the size of the text if it has fewer characters
+static size_t skip_chars(std::string_view text, size_t column)
+{
+    for (size_t pos = 0; pos < text.size(); pos++)
+    {
+        if (starts_char(text[pos]) && column-- == 0)
+            return pos;
+    }
+    return text.size();
+}
+
+int brackets::depth_change(char c)
+{
+    switch (c)
+    {
+    case '(':
+    case '[':
+    case '{':
+        return 1;
+    case ')':
+    case ']':
+    case '}':
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+BracketSummary brackets::summarize(std::string_view text)
+{
+    BracketSummary summary;
+    for (char c : text)
+    {
+        int change = depth_change(c);
+        if (change == 0)
+            continue;
+
+        summary.delta += change;
+        summary.min_prefix = std::min(summary.min_prefix, summary.delta);
+        summary.max_suffix = std::max<int64_t>(0, summary.max_suffix + change);
+    }
+    return summary;
+}
+
+BracketSummary brackets::combine(const BracketSummary& left, const BracketSummary& right)
+{
+    BracketSummary summary;
+    summary.delta = left.delta + right.delta;
+    summary.min_prefix = std::min(left.min_prefix, left.delta + right.min_prefix);
+    summary.max_suffix = std::max(right.max_suffix, right.delta + left.max_suffix);
+    return summary;
+}
+
+size_t brackets::scan_forward(std::string_view text, size_t from, int64_t& depth)
+{
+    for (size_t i = from; i < text.size(); i++)
+    {
+        depth += depth_change(text[i]);
+        if (depth < 0)
+            return i;
+    }
+    return std::string_view::npos;
+}
+
+size_t brackets::scan_backward(std::string_view text, size_t to, int64_t& depth)
+{
+    for (size_t i = std::min(to, text.size()); i-- > 0;)
+    {
+        depth += depth_change(text[i]);
+        if (depth > 0)
+            return i;
+    }
+    return std::string_view::npos;
+}
+
+BracketBlocks::BracketBlocks(std::string_view text) : root(build(split_blocks(text)))
+{
+}
+
+bool BracketBlocks::empty() const
+{
+    return root == nullptr;
+}
+
+size_t BracketBlocks::size() const
+{
+    return root ? root->total.bytes : 0;
+}
+
+BracketSummary BracketBlocks::summary() const
+{
+    return root ? root->total.brackets : BracketSummary();
+}
+
+BracketBlocks BracketBlocks::edited(TextArena& arena, size_t at, size_t erased, std::string_view text) const
+{
+    size_t old_size = size();
+    at = std::min(at, old_size);
+    erased = std::min(erased, old_size - at);
+    size_t new_size = old_size - erased + text.size();
+
+    // The blocks holding the first and last erased bytes, or just the one holding at, are rewritten
+    size_t start = 0, end = old_size, first = 0, last = 0;
+    bool whole = !root || root->count == 0;
+    if (!whole)
+    {
+        size_t last_start, last_end;
+        first = block_at(at, start, end);
+        last = erased > 0 ? block_at(at + erased - 1, last_start, last_end) : first;
+        if (erased > 0)
+            end = last_end;
+
+        // Take in a neighbour rather than leave a runt block behind
+        if (end - erased + text.size() - start < BLOCK_BYTES / 2)
+        {
+            size_t neighbour_start, neighbour_end;
+            if (last + 1 < root->count)
+            {
+                block_at(end, neighbour_start, neighbour_end);
+                end = neighbour_end;
+                last++;
+            }
+            else if (first > 0)
+            {
+                block_at(start - 1, neighbour_start, neighbour_end);
+                start = neighbour_start;
+                first--;
+            }
+        }
+
+        // An edit spanning most of the line costs about as much as writing all of it again
+        whole = 2 * (end - erased + text.size() - start) > new_size;
+    }
+    if (whole)
+    {
+        start = 0;
+        end = old_size;
+    }
+
+    // Write the new text of the rewritten blocks to the arena
+    size_t span = end - erased + text.size() - start;
+    char* data = span > 0 ? arena.allocate(span) : nullptr;
+    copy(start, at - start, data);
+    std::copy(text.begin(), text.end(), data + (at - start));
+    copy(at + erased, end - at - erased, data + (at - start) + text.size());
+
+    if (whole)
+        return BracketBlocks(std::string_view(data, span));
+
+    BracketBlocks result = *this;
+    result.replace(first, last - first + 1, split_blocks(std::string_view(data, span)));
+    return result;
+}
+
+BracketBlocks BracketBlocks::slice(size_t from, size_t to) const
+{
+    std::vector<Block> blocks;
+    if (root && from < to)
+        collect(*root, 0, from, to, blocks);
+    BracketBlocks result;
+    result.root = build(blocks);
+    return result;
+}
+
+BracketBlocks BracketBlocks::joined(const BracketBlocks& other) const
+{
+    std::vector<Block> blocks;
+    if (root)
+        collect(*root, 0, 0, size(), blocks);
+    if (other.root)
+        collect(*other.root, 0, 0, other.size(), blocks);
+    BracketBlocks result;
+    result.root = build(blocks);
+    return result;
+}
+
+void BracketBlocks::copy(size_t from, size_t count, char* out) const
+{
+    if (root && count > 0)
+        copy(*root, 0, from, from + count, out);
+}
+
+BracketBlocks BracketBlocks::relocated(char*& out) const
+{
+    BracketBlocks result;
+    if (root)
+        result.root = relocate(root, out);
+    return result;
+}
+
+size_t BracketBlocks::byte_of_column(size_t column) const
+{
+    if (!root)
+        return 0;
+    if (column >= root->total.chars)
+        return root->total.bytes;
+
+    // Descend to the block holding the character, then count characters within it
+    const Node* node = root.get();
+    size_t pos = 0;
+    while (!node->children.empty())
+    {
+        for (const auto& child : node->children)
+        {
+            if (column < child->total.chars)
+            {
+                node = child.get();
+                break;
+            }
+            column -= child->total.chars;
+            pos += child->total.bytes;
+        }
+    }
+    for (const auto& block : node->blocks)
+    {
+        if (column < block.chars)
+            return pos + skip_chars(std::string_view(block.text, block.bytes), column);
+        column -= block.chars;
+        pos += block.bytes;
+    }
+    return pos;
+}
+
+size_t BracketBlocks::column_of_byte(size_t byte) const
+{
+    if (!root)
+        return 0;
+    if (byte >= root->total.bytes)
+        return root->total.chars;
+
+    const Node* node = root.get();
+    size_t pos = 0;
+    size_t column = 0;
+    while (!node->children.empty())
+    {
+        for (const auto& child : node->children)
+        {
+            if (byte < pos + child->total.bytes)
+            {
+                node = child.get();
+                break;
+            }
+            column += child->total.chars;
+            pos += child->total.bytes;
+        }
+    }
+    for (const auto& block : node->blocks)
+    {
+        if (byte < pos + block.bytes)
+            return column + count_chars(std::string_view(block.text, byte - pos));
+        column += block.chars;
+        pos += block.bytes;
+    }
+    return column;
+}
+
+size_t BracketBlocks::byte_of_column(std::string_view text, size_t column)
+{
+    return skip_chars(text, column);
+}
+
+size_t BracketBlocks::column_of_byte(std::string_view text, size_t byte)
+{
+    return count_chars(text.substr(0, byte));
+}
+
+size_t BracketBlocks::find_forward(size_t from, int64_t& depth) const
+{
+    if (!root)
+        return std::string_view::npos;
+    return find_forward(*root, 0, from, depth);
+}
+
+size_t BracketBlocks::find_backward(size_t to, int64_t& depth) const
+{
+    if (!root)
+        return std::string_view::npos;
+    return find_backward(*root, 0, std::min(to, size()), depth);
+}
+
+BracketBlocks::Block BracketBlocks::summarize_block(const char* text, size_t bytes)
+{
+    Block block;
+    block.text = text;
+    block.bytes = bytes;
+    block.chars = count_chars(std::string_view(text, bytes));
+    block.brackets = brackets::summarize(std::string_view(text, bytes));
+    return block;
+}
+
+// Cuts text into the fewest blocks of at most BLOCK_BYTES, all of about the same size
+std::vector<BracketBlocks::Block> BracketBlocks::split_blocks(std::string_view text)
+{
+    std::vector<Block> blocks;
+    size_t count = (text.size() + BLOCK_BYTES - 1) / BLOCK_BYTES;
+    blocks.reserve(count);
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t size = text.size() / count + (i < text.size() % count ? 1 : 0);
+        blocks.push_back(summarize_block(text.data() + pos, size));
+        pos += size;
+    }
+    return blocks;
+}
+
+BracketBlocks::NodePtr BracketBlocks::build(const std::vector<Block>& blocks)
+{
+    std::vector<NodePtr> nodes;
+    for (size_t i = 0; i < blocks.size(); i += MAX_ENTRIES)
+    {
+        auto leaf = std::make_shared<Node>();
+        leaf->blocks.assign(blocks.begin() + i, blocks.begin() + std::min(blocks.size(), i + MAX_ENTRIES));
+        update(*leaf);
+        nodes.push_back(std::move(leaf));
+    }
+
+    if (nodes.empty())
+        return std::make_shared<Node>();
+
+    while (nodes.size() > 1)
+    {
+        std::vector<NodePtr> parents;
+        for (size_t i = 0; i < nodes.size(); i += MAX_ENTRIES)
+        {
+            auto parent = std::make_shared<Node>();
+            size_t end = std::min(nodes.size(), i + MAX_ENTRIES);
+            for (size_t j = i; j < end; j++)
+                parent->children.push_back(std::move(nodes[j]));
+            update(*parent);
+            parents.push_back(std::move(parent));
+        }
+        nodes = std::move(parents);
+    }
+    return nodes.front();
+}
+
+BracketBlocks::NodePtr BracketBlocks::set(const NodePtr& node, size_t index, const Block& block)
+{
+    auto copy = std::make_shared<Node>(*node);
+    if (copy->children.empty())
+    {
+        copy->blocks[index] = block;
+    }
+    else
+    {
+        for (auto& child : copy->children)
+        {
+            if (index < child->count)
+            {
+                child = set(child, index, block);
+                break;
+            }
+            index -= child->count;
+        }
+    }
+    update(*copy);
+    return copy;
+}
+
+BracketBlocks::NodePtr BracketBlocks::insert(const NodePtr& node, size_t index, const Block& block, NodePtr& split)
+{
+    auto copy = std::make_shared<Node>(*node);
+    if (copy->children.empty())
+    {
+        copy->blocks.insert(copy->blocks.begin() + index, block);
+        if (copy->blocks.size() > MAX_ENTRIES)
+        {
+            // Move the upper half into a new sibling
+            auto sibling = std::make_shared<Node>();
+            size_t half = copy->blocks.size() / 2;
+            sibling->blocks.assign(copy->blocks.begin() + half, copy->blocks.end());
+            copy->blocks.resize(half);
+            update(*sibling);
+            split = sibling;
+        }
+        update(*copy);
+        return copy;
+    }
+
+    // Appending at the end of a child is allowed, so that index == count lands in the last child
+    size_t k = 0;
+    while (k + 1 < copy->children.size() && index > copy->children[k]->count)
+    {
+        index -= copy->children[k]->count;
+        k++;
+    }
+
+    NodePtr child_split;
+    copy->children[k] = insert(copy->children[k], index, block, child_split);
+    if (child_split)
+        copy->children.insert(copy->children.begin() + k + 1, child_split);
+
+    if (copy->children.size() > MAX_ENTRIES)
+    {
+        auto sibling = std::make_shared<Node>();
+        size_t half = copy->children.size() / 2;
+        sibling->children.assign(copy->children.begin() + half, copy->children.end());
+        copy->children.resize(half);
+        update(*sibling);
+        split = sibling;
+    }
+    update(*copy);
+    return copy;
+}
+
+BracketBlocks::NodePtr BracketBlocks::erase(const NodePtr& node, size_t index)
+{
+    auto copy = std::make_shared<Node>(*node);
+    if (copy->children.empty())
+    {
+        copy->blocks.erase(copy->blocks.begin() + index);
+        update(*copy);
+        return copy->blocks.empty() ? nullptr : copy;
+    }
+
+    for (auto it = copy->children.begin(); it != copy->children.end(); ++it)
+    {
+        if (index < (*it)->count)
+        {
+            // Empty children are removed rather than rebalanced, as in LineTree
+            NodePtr child = erase(*it, index);
+            if (child)
+                *it = child;
+            else
+                copy->children.erase(it);
+            break;
+        }
+        index -= (*it)->count;
+    }
+    update(*copy);
+    return copy->children.empty() ? nullptr : copy;
+}
+
+void BracketBlocks::update(Node& node)
+{
+    node.count = node.blocks.size();
+    node.total = Block();
+    for (const auto& block : node.blocks)
+    {
+        node.total.bytes += block.bytes;
+        node.total.chars += block.chars;
+        node.total.brackets = brackets::combine(node.total.brackets, block.brackets);
+    }
+    for (const auto& child : node.children)
+    {
+        node.count += child->count;
+        node.total.bytes += child->total.bytes;
+        node.total.chars += child->total.chars;
+        node.total.brackets = brackets::combine(node.total.brackets, child->total.brackets);
+    }
+}
+
+// Copies node, pointing its blocks at consecutive bytes starting at out to which their text is copied
+BracketBlocks::NodePtr BracketBlocks::relocate(const NodePtr& node, char*& out)
+{
+    auto copy = std::make_shared<Node>(*node);
+    for (auto& block : copy->blocks)
+    {
+        std::copy(block.text, block.text + block.bytes, out);
+        block.text = out;
+        out += block.bytes;
+    }
+    for (auto& child : copy->children)
+        child = relocate(child, out);
+    return copy;
+}
+
+// Appends the blocks of node, which begins at byte start, that overlap bytes from to to, cutting the ones at either
+// end down to the part inside
+void BracketBlocks::collect(const Node& node, size_t start, size_t from, size_t to, std::vector<Block>& blocks)
+{
+    if (start >= to || start + node.total.bytes <= from)
+        return;
+
+    size_t pos = start;
+    for (const auto& block : node.blocks)
+    {
+        size_t begin = std::max(from, pos);
+        size_t end = std::min(to, pos + block.bytes);
+        if (begin == pos && end == pos + block.bytes)
+            blocks.push_back(block);
+        else if (begin < end)
+            blocks.push_back(summarize_block(block.text + (begin - pos), end - begin));
+        pos += block.bytes;
+    }
+    for (const auto& child : node.children)
+    {
+        collect(*child, pos, from, to, blocks);
+        pos += child->total.bytes;
+    }
+}
+
+// Copies bytes from to to of node, which begins at byte start, to out, advancing it
+void BracketBlocks::copy(const Node& node, size_t start, size_t from, size_t to, char*& out)
+{
+    if (start >= to || start + node.total.bytes <= from)
+        return;
+
+    size_t pos = start;
+    for (const auto& block : node.blocks)
+    {
+        size_t begin = std::max(from, pos);
+        size_t end = std::min(to, pos + block.bytes);
+        if (begin < end)
+            out = std::copy(block.text + (begin - pos), block.text + (end - pos), out);
+        pos += block.bytes;
+    }
+    for (const auto& child : node.children)
+    {
+        copy(*child, pos, from, to, out);
+        pos += child->total.bytes;
+    }
+}
+
+// Scans the part of node, which begins at byte start of the line, from byte from onwards. Blocks and subtrees in
+// which the depth never drops below zero are skipped by their summaries.
+size_t BracketBlocks::find_forward(const Node& node, size_t start, size_t from, int64_t& depth)
+{
+    if (start + node.total.bytes <= from)
+        return std::string_view::npos;
+    if (from <= start && depth + node.total.brackets.min_prefix >= 0)
+    {
+        depth += node.total.brackets.delta;
+        return std::string_view::npos;
+    }
+
+    size_t pos = start;
+    for (const auto& block : node.blocks)
+    {
+        size_t end = pos + block.bytes;
+        if (end > from)
+        {
+            if (from <= pos && depth + block.brackets.min_prefix >= 0)
+            {
+                depth += block.brackets.delta;
+            }
+            else
+            {
+                std::string_view text(block.text, block.bytes);
+                size_t found = brackets::scan_forward(text, std::max(from, pos) - pos, depth);
+                if (found != std::string_view::npos)
+                    return pos + found;
+            }
+        }
+        pos = end;
+    }
+
+    for (const auto& child : node.children)
+    {
+        size_t found = find_forward(*child, pos, from, depth);
+        if (found != std::string_view::npos)
+            return found;
+        pos += child->total.bytes;
+    }
+    return std::string_view::npos;
+}
+
+// Scans the part of node, which begins at byte start of the line, backwards from just before byte to.
+size_t BracketBlocks::find_backward(const Node& node, size_t start, size_t to, int64_t& depth)
+{
+    if (start >= to)
+        return std::string_view::npos;
+    size_t end = start + node.total.bytes;
+    if (end <= to && depth + node.total.brackets.max_suffix < 1)
+    {
+        depth += node.total.brackets.delta;
+        return std::string_view::npos;
+    }
+
+    size_t pos = end;
+    for (auto block = node.blocks.rbegin(); block != node.blocks.rend(); ++block)
+    {
+        size_t begin = pos - block->bytes;
+        if (begin < to)
+        {
+            if (pos <= to && depth + block->brackets.max_suffix < 1)
+            {
+                depth += block->brackets.delta;
+            }
+            else
+            {
+                std::string_view text(block->text, block->bytes);
+                size_t found = brackets::scan_backward(text, std::min(to, pos) - begin, depth);
+                if (found != std::string_view::npos)
+                    return begin + found;
+            }
+        }
+        pos = begin;
+    }
+
+    for (auto child = node.children.rbegin(); child != node.children.rend(); ++child)
+    {
+        size_t begin = pos - (*child)->total.bytes;
+        size_t found = find_backward(**child, begin, to, depth);
+        if (found != std::string_view::npos)
+            return found;
+        pos = begin;
+    }
+    return std::string_view::npos;
+}
+
+size_t BracketBlocks::block_at(size_t byte, size_t& start, size_t& end) const
+{
+    byte = std::min(byte, root->total.bytes - 1);
+    const Node* node = root.get();
+    size_t index = 0;
+    start = 0;
+    while (!node->children.empty())
+    {
+        for (const auto& child : node->children)
+        {
+            if (byte < start + child->total.bytes)
+            {
+                node = child.get();
+                break;
+            }
+            start += child->total.bytes;
+            index += child->count;
+        }
+    }
+    for (const auto& block : node->blocks)
+    {
+        if (byte < start + block.bytes)
+        {
+            end = start + block.bytes;
+            break;
+        }
+        start += block.bytes;
+        index++;
+    }
+    return index;
+}
+
+// Replaces count blocks starting at first with blocks
+void BracketBlocks::replace(size_t first, size_t count, const std::vector<Block>& blocks)
+{
+    size_t common = std::min(count, blocks.size());
+    for (size_t i = 0; i < common; i++)
+        root = set(root, first + i, blocks[i]);
+
+    for (size_t i = common; i < count; i++)
+    {
+        root = erase(root, first + common);
+        if (!root)
+            root = std::make_shared<Node>();
+
+        // Drop roots left with a single child
+        while (root->children.size() == 1)
+            root = root->children.front();
+    }
+
+    for (size_t i = common; i < blocks.size(); i++)
+    {
+        NodePtr split;
+        root = insert(root, first + i, blocks[i], split);
+        if (split)
+        {
+            // The root overflowed, so the tree grows by one level
+            auto new_root = std::make_shared<Node>();
+            new_root->children = {root, split};
+            update(*new_root);
+            root = new_root;
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef BRACKETS_H
+#define BRACKETS_H
+
+#include "text_arena.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Effect of a stretch of text on bracket nesting. Opening brackets ( [ { count +1 and closing brackets ) ] } -1;
+// the kinds aren't told apart, and brackets inside strings or comments are counted like any other.
+struct BracketSummary
+{
+    int64_t delta = 0;      // depth at the end, relative to the start
+    int64_t min_prefix = 0; // lowest depth reached, relative to the start (never above 0)
+    int64_t max_suffix = 0; // highest count of opening minus closing brackets over any tail (never below 0)
+};
+
+namespace brackets
+{
+
+// Returns +1 for an opening bracket, -1 for a closing bracket and 0 otherwise.
+int depth_change(char c);
+
+BracketSummary summarize(std::string_view text);
+
+// Summary of left followed by right.
+BracketSummary combine(const BracketSummary& left, const BracketSummary& right);
+
+// Scans text from byte from, starting at depth, and returns the offset of the first closing bracket that takes the
+// depth below zero. Returns npos if there is none, with depth updated to the end of the text.
+size_t scan_forward(std::string_view text, size_t from, int64_t& depth);
+
+// Scans text backwards from just before byte to, where depth is the opening minus closing brackets already passed,
+// and returns the offset of the first opening bracket that takes it above zero. Returns npos if there is none, with
+// depth updated to the start of the text.
+size_t scan_backward(std::string_view text, size_t to, int64_t& depth);
+
+} // namespace brackets
+
+// Text of one long line, held as a persistent B-tree of blocks of at most BLOCK_BYTES. Each block points at its text
+// and records its length in bytes and in characters and its bracket summary, so searching the line for a bracket or
+// converting between columns and byte offsets descends the tree and scans at most two blocks. An edit writes new text
+// only for the blocks it touches and shares the others, so it costs about a block however long the line is, and
+// copies of the line stay unchanged.
+//
+// The blocks don't own their text; it lives in the arena of the LineTree holding the line. Characters are counted as
+// the bytes which don't continue a UTF-8 sequence.
+class BracketBlocks
+{
+    struct Block
+    {
+        const char* text = nullptr;
+        size_t bytes = 0;
+        size_t chars = 0;
+        BracketSummary brackets;
+    };
+
+    struct Node
+    {
+        size_t count = 0;                                  // number of blocks in this subtree
+        Block total;                                       // all the blocks of this subtree taken together
+        std::vector<Block> blocks;                         // leaf nodes only
+        std::vector<std::shared_ptr<const Node>> children; // internal nodes only
+    };
+    using NodePtr = std::shared_ptr<const Node>;
+
+    NodePtr root;
+
+  public:
+    static constexpr size_t BLOCK_BYTES = 4096;
+
+    // No blocks at all, as for a line which isn't long enough to need them.
+    BracketBlocks() = default;
+
+    // Splits text, which must outlive the line and every line made from it, into blocks.
+    explicit BracketBlocks(std::string_view text);
+
+    bool empty() const;
+    size_t size() const;
+    BracketSummary summary() const;
+
+    // Returns the line with erased bytes at byte at replaced by text. The blocks the edit touches are given new text
+    // in arena; the others are shared with this line.
+    BracketBlocks edited(TextArena& arena, size_t at, size_t erased, std::string_view text) const;
+
+    // Returns bytes from to to of the line, and this line followed by other. Both share the text they are made from
+    // and cost a step per block, which is fine for splitting and joining lines but not for every keystroke.
+    BracketBlocks slice(size_t from, size_t to) const;
+    BracketBlocks joined(const BracketBlocks& other) const;
+
+    // Copies count bytes starting at byte from to out.
+    void copy(size_t from, size_t count, char* out) const;
+
+    // Copies the text to consecutive bytes starting at out, which is advanced past them, and returns the same line
+    // reading its text from there.
+    BracketBlocks relocated(char*& out) const;
+
+    // Returns the offset of the character at column, or the size of the line if it has fewer characters.
+    size_t byte_of_column(size_t column) const;
+
+    // Returns the number of characters which start before byte.
+    size_t column_of_byte(size_t byte) const;
+
+    // Same as byte_of_column and column_of_byte for text which isn't held in blocks.
+    static size_t byte_of_column(std::string_view text, size_t column);
+    static size_t column_of_byte(std::string_view text, size_t byte);
+
+    // Same as brackets::scan_forward and brackets::scan_backward over the text of the line.
+    size_t find_forward(size_t from, int64_t& depth) const;
+    size_t find_backward(size_t to, int64_t& depth) const;
+
+  private:
+    static Block summarize_block(const char* text, size_t bytes);
+    static std::vector<Block> split_blocks(std::string_view text);
+    static NodePtr build(const std::vector<Block>& blocks);
+    static NodePtr set(const NodePtr& node, size_t index, const Block& block);
+    static NodePtr insert(const NodePtr& node, size_t index, const Block& block, NodePtr& split);
+    static NodePtr erase(const NodePtr& node, size_t index);
+    static NodePtr relocate(const NodePtr& node, char*& out);
+    static void update(Node& node);
+    static void collect(const Node& node, size_t start, size_t from, size_t to, std::vector<Block>& blocks);
+    static void copy(const Node& node, size_t start, size_t from, size_t to, char*& out);
+    static size_t find_forward(const Node& node, size_t start, size_t from, int64_t& depth);
+    static size_t find_backward(const Node& node, size_t start, size_t to, int64_t& depth);
+
+    // Returns the index of the block holding byte, clamped to the last block, and sets start and end to its bounds.
+    size_t block_at(size_t byte, size_t& start, size_t& end) const;
+    void replace(size_t first, size_t count, const std::vector<Block>& blocks);
+};
+
+#endif
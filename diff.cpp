@@ -0,0 +1,219 @@
+#include "diff.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+// Longest a diff may search for a minimal script. Past this the part still being searched is replaced wholesale, so
+// a reload of a file rewritten from scratch still finishes promptly.
+static const std::chrono::milliseconds TIME_LIMIT(2000);
+
+namespace
+{
+
+// State shared by the steps of one diff. a and b number the differing lines, which start at line prefix of both texts,
+// so that the search compares integers rather than strings. forward and backward hold the furthest reaching paths of
+// the search in progress and are reused by every step, so memory stays linear in the number of lines.
+struct Search
+{
+    size_t prefix;
+    std::vector<int> a;
+    std::vector<int> b;
+    std::vector<long> forward;
+    std::vector<long> backward;
+    const CancellationToken& token;
+    std::chrono::steady_clock::time_point deadline;
+    bool cancelled = false;
+    std::vector<DiffHunk> hunks;
+};
+
+// Common part in the middle of an optimal script, from (x, y) to (u, v)
+struct Snake
+{
+    long x, y, u, v;
+};
+
+} // namespace
+
+// Appends an edit to hunks, merging it into the last hunk when they touch
+static void add_edit(std::vector<DiffHunk>& hunks, size_t old_start, size_t old_count, size_t new_start,
+                     size_t new_count)
+{
+    if (!hunks.empty())
+    {
+        DiffHunk& last = hunks.back();
+        if (last.old_start + last.old_count == old_start && last.new_start + last.new_count == new_start)
+        {
+            last.old_count += old_count;
+            last.new_count += new_count;
+            return;
+        }
+    }
+    hunks.push_back({old_start, old_count, new_start, new_count});
+}
+
+// Finds the middle snake of an optimal script turning n lines of a at a0 into m lines of b at b0, searching forwards
+// from the start and backwards from the end at once until the paths meet. Returns false if the search ran out of
+// time or was cancelled.
+static bool find_middle_snake(Search& search, long a0, long n, long b0, long m, Snake& snake)
+{
+    const int* a = search.a.data() + a0;
+    const int* b = search.b.data() + b0;
+    long delta = n - m;
+    bool odd = delta % 2 != 0;
+    long max_d = (n + m + 1) / 2;
+
+    // forward[k + offset] is the furthest x reached on diagonal k = x - y. backward[k + offset] is the same for
+    // the search from the end, counting x and y back from n and m.
+    long offset = max_d + 1;
+    std::vector<long>& forward = search.forward;
+    std::vector<long>& backward = search.backward;
+    forward[offset + 1] = 0;
+    backward[offset + 1] = 0;
+
+    for (long d = 0; d <= max_d; d++)
+    {
+        if (search.token.cancelled())
+        {
+            search.cancelled = true;
+            return false;
+        }
+        if (std::chrono::steady_clock::now() > search.deadline)
+            return false;
+
+        for (long k = -d; k <= d; k += 2)
+        {
+            long x;
+            if (k == -d || (k != d && forward[k - 1 + offset] < forward[k + 1 + offset]))
+                x = forward[k + 1 + offset]; // down from diagonal k + 1: insert a line of the new text
+            else
+                x = forward[k - 1 + offset] + 1; // right from diagonal k - 1: delete a line of the old text
+            long y = x - k;
+            long start_x = x;
+            long start_y = y;
+            while (x < n && y < m && a[x] == b[y])
+            {
+                x++;
+                y++;
+            }
+            forward[k + offset] = x;
+
+            // The backward search has only reached diagonals within d - 1 of delta
+            long back_k = delta - k;
+            if (odd && back_k >= -(d - 1) && back_k <= d - 1 && x + backward[back_k + offset] >= n)
+            {
+                snake = {start_x, start_y, x, y};
+                return true;
+            }
+        }
+
+        for (long k = -d; k <= d; k += 2)
+        {
+            long x;
+            if (k == -d || (k != d && backward[k - 1 + offset] < backward[k + 1 + offset]))
+                x = backward[k + 1 + offset];
+            else
+                x = backward[k - 1 + offset] + 1;
+            long y = x - k;
+            long start_x = x;
+            long start_y = y;
+            while (x < n && y < m && a[n - 1 - x] == b[m - 1 - y])
+            {
+                x++;
+                y++;
+            }
+            backward[k + offset] = x;
+
+            long forward_k = delta - k;
+            if (!odd && forward_k >= -d && forward_k <= d && x + forward[forward_k + offset] >= n)
+            {
+                snake = {n - x, m - y, n - start_x, m - start_y};
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Appends the hunks turning n lines of the old text at a0 into m lines of the new text at b0. Each step splits the
+// range at the middle snake and recurses on either side of it, which halves the edit distance left to search.
+static void diff_range(Search& search, long a0, long n, long b0, long m)
+{
+    // Strip what is shared at both ends, which leaves nothing on one side when only one kind of edit remains
+    while (n > 0 && m > 0 && search.a[a0] == search.b[b0])
+    {
+        a0++;
+        b0++;
+        n--;
+        m--;
+    }
+    while (n > 0 && m > 0 && search.a[a0 + n - 1] == search.b[b0 + m - 1])
+    {
+        n--;
+        m--;
+    }
+
+    if (n == 0 || m == 0)
+    {
+        if (n > 0 || m > 0)
+            add_edit(search.hunks, search.prefix + a0, n, search.prefix + b0, m);
+        return;
+    }
+
+    Snake snake;
+    if (!find_middle_snake(search, a0, n, b0, m, snake))
+    {
+        add_edit(search.hunks, search.prefix + a0, n, search.prefix + b0, m);
+        return;
+    }
+    diff_range(search, a0, snake.x, b0, snake.y);
+    if (search.cancelled)
+        return;
+    diff_range(search, a0 + snake.u, n - snake.u, b0 + snake.v, m - snake.v);
+}
+
+std::vector<DiffHunk> diff_lines(const std::vector<std::string_view>& old_lines,
+                                 const std::vector<std::string_view>& new_lines, const CancellationToken& token)
+{
+    // Most reloads change a small region, so strip what is shared at both ends before numbering the lines
+    size_t prefix = 0;
+    while (prefix < old_lines.size() && prefix < new_lines.size() && old_lines[prefix] == new_lines[prefix])
+        prefix++;
+    size_t suffix = 0;
+    while (suffix < old_lines.size() - prefix && suffix < new_lines.size() - prefix &&
+           old_lines[old_lines.size() - 1 - suffix] == new_lines[new_lines.size() - 1 - suffix])
+        suffix++;
+
+    long n = old_lines.size() - prefix - suffix;
+    long m = new_lines.size() - prefix - suffix;
+    if (n == 0 && m == 0)
+        return {};
+
+    // Give every distinct line a number so that the search compares integers rather than strings
+    Search search{prefix, {}, {}, {}, {}, token, std::chrono::steady_clock::now() + TIME_LIMIT};
+    std::unordered_map<std::string_view, int> ids;
+    search.a.resize(n);
+    search.b.resize(m);
+    for (long i = 0; i < n; i++)
+        search.a[i] = ids.emplace(old_lines[prefix + i], ids.size()).first->second;
+    int old_ids = ids.size();
+    bool shared = false;
+    for (long j = 0; j < m; j++)
+    {
+        search.b[j] = ids.emplace(new_lines[prefix + j], ids.size()).first->second;
+        shared = shared || search.b[j] < old_ids;
+    }
+
+    // A file rewritten from scratch shares no lines with the old text, so there is nothing to search for
+    if (!shared)
+        return {{prefix, (size_t)n, prefix, (size_t)m}};
+
+    // Every step searches at most half the lines it is given in each direction, so both paths fit in this
+    size_t paths = (n + m + 1) / 2 * 2 + 3;
+    search.forward.resize(paths);
+    search.backward.resize(paths);
+
+    diff_range(search, 0, n, 0, m);
+    if (search.cancelled)
+        return {};
+    return search.hunks;
+}
@@ -0,0 +1,25 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "thread_pool.h"
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Replaces old_count lines at old_start in the old text with new_count lines from new_start in the new text.
+struct DiffHunk
+{
+    size_t old_start;
+    size_t old_count;
+    size_t new_start;
+    size_t new_count;
+};
+
+// Returns the hunks turning old_lines into new_lines, in ascending order, using the linear space variant of Myers'
+// algorithm on the part that differs after trimming the common prefix and suffix. The hunks are minimal unless the
+// search runs past a time limit, in which case the part it hadn't finished is replaced wholesale. Returns early, with
+// no hunks, if token is cancelled.
+std::vector<DiffHunk> diff_lines(const std::vector<std::string_view>& old_lines,
+                                 const std::vector<std::string_view>& new_lines, const CancellationToken& token);
+
+#endif
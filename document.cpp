@@ -1,120 +1,164 @@
 #include "document.h"
 #include "utf8.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <list>
 #include <ncurses.h>
 #include <string>
+#include <vector>
 
-Document::Document(const std::string& filename)
+// Files at least this large are opened read-only through a page cache rather than loaded into memory
+static const uint64_t READ_ONLY_THRESHOLD = 512ull * 1024 * 1024;
+
+// Upper bound on the memory used for cached pages of a read-only file
+static const size_t PAGE_CACHE_BYTES = 16 * 1024 * 1024;
+
+// Lines of a read-only file longer than this are truncated in the view
+static const size_t MAX_LINE_BYTES = 1024 * 1024;
+
+// Reads the lines of a file into arena. A file which can't be read gives a single empty line.
+static std::vector<std::string_view> read_lines(const std::string& filename, TextArena& arena)
 {
-    std::ifstream file(filename);
-    std::string line;
+    std::vector<std::string_view> file_lines;
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(filename, ec);
+    std::ifstream file;
+    if (!ec)
+        file.open(filename, std::ios::binary);
 
     if (file.is_open())
     {
-        while (std::getline(file, line))
+        // Read the whole file into one arena block and point the lines into it, rather than allocating each line
+        char* text = arena.allocate(size);
+        file.read(text, size);
+        size_t length = file.gcount();
+
+        size_t start = 0;
+        while (start < length)
         {
-            lines.push_back(line);
+            auto newline = static_cast<const char*>(memchr(text + start, '\n', length - start));
+            size_t end = newline ? newline - text : length;
+            file_lines.emplace_back(text + start, end - start);
+            start = end + 1;
         }
         file.close();
     }
-    else
+
+    // If the file cannot be opened or is empty, initialize the document with an empty line.
+    if (file_lines.empty())
+        file_lines.emplace_back();
+    return file_lines;
+}
+
+Document::Document(const std::string& filename) : filename(filename)
+{
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(filename, ec);
+    if (!ec && size >= READ_ONLY_THRESHOLD)
     {
-        // If the file cannot be opened, initialize the document with an empty line.
-        lines.emplace_back("");
+        paged = std::make_unique<PagedFile>(filename, PAGE_CACHE_BYTES);
+        if (!paged->is_open())
+            paged.reset();
     }
 
-    cur_line = lines.begin();
+    auto arena = std::make_shared<TextArena>();
+    if (paged)
+        lines = LineTree(arena, {std::string_view()});
+    else
+        lines = LineTree(arena, read_lines(filename, *arena));
+    cur_line = 0;
     cur_col = 0;
     clear_selection();
 }
 
 Document::Document()
 {
-    lines.emplace_back("");
-    cur_line = lines.begin();
+    lines.insert(0, "");
+    cur_line = 0;
     cur_col = 0;
     clear_selection();
 }
 
 void Document::insert(char ch)
 {
+    if (paged)
+        return;
+
+    // Edits go through byte offsets found by the line tree, which doesn't rescan long lines to find them
+    size_t at = lines.byte_of_column(cur_line, cur_col);
     if (ch == '\n')
     {
         // Split the current line into two lines
-        std::string tail = utf8::substr(*cur_line, cur_col, utf8::str_length(*cur_line) - cur_col);
-        *cur_line = utf8::substr(*cur_line, 0, cur_col);
-        lines.insert(std::next(cur_line), tail);
+        lines.split(cur_line, at);
         cur_col = 0;
         cur_line++;
     }
     else
     {
-        std::string ch_str(1, ch);
-        std::string pre = utf8::substr(*cur_line, 0, cur_col);
-        std::string post = utf8::substr(*cur_line, cur_col, utf8::str_length(*cur_line) - cur_col);
-        *cur_line = pre + ch_str + post;
+        lines.splice(cur_line, at, 0, std::string_view(&ch, 1));
         cur_col += 1;
     }
+    edit_version++;
     scroll_to_cursor();
 }
 
 void Document::delete_forward()
 {
+    if (paged)
+        return;
+
     // If there's no current line, we have nothing to delete
-    if (cur_line == lines.end())
+    if (cur_line >= lines.size())
         return;
 
     // If the cursor is at the end of the line
-    if (cur_col == utf8::str_length(*cur_line))
+    if (cur_col == lines.length(cur_line))
     {
         // If the cursor is at the end of the Document
-        auto next_line = std::next(cur_line);
-        if (next_line == lines.end())
+        size_t next_line = cur_line + 1;
+        if (next_line == lines.size())
             return;
 
-        // Merge current line with next line
-        *cur_line += *next_line;
-
-        // Delete the next line
-        lines.erase(next_line);
+        // Merge the next line into the current line
+        lines.join(cur_line);
     }
     else // Cursor is in the middle of the line
     {
-        // Manually erase the character at the cursor using substrings
-        std::string pre = utf8::substr(*cur_line, 0, cur_col);
-        std::string post = utf8::substr(*cur_line, cur_col + 1, utf8::str_length(*cur_line) - cur_col - 1);
-        *cur_line = pre + post;
+        // Erase the bytes of the character at the cursor
+        size_t at = lines.byte_of_column(cur_line, cur_col);
+        lines.splice(cur_line, at, lines.byte_of_column(cur_line, cur_col + 1) - at, {});
     }
+    edit_version++;
     scroll_to_cursor();
 }
 
 void Document::delete_backward()
 {
+    if (paged)
+        return;
+
     // If there's no current line, we have nothing to delete
-    if (cur_line == lines.end())
+    if (cur_line >= lines.size())
         return;
 
     // If the cursor is at the beginning of the line
     if (cur_col == 0)
     {
         // If the cursor is at the beginning of the Document
-        if (cur_line == lines.begin())
+        if (cur_line == 0)
             return;
 
-        // Store previous line iterator
-        auto prev_line = std::prev(cur_line);
+        // Store previous line index
+        size_t prev_line = cur_line - 1;
 
         // Move cursor to the end of the previous line
-        cur_col = utf8::str_length(*prev_line);
-
-        // Merge previous line with current line
-        *prev_line += *cur_line;
+        cur_col = lines.length(prev_line);
 
-        // Delete the current line
-        lines.erase(cur_line);
+        // Merge the current line into the previous line
+        lines.join(prev_line);
 
-        // Update current line iterator to previous line
+        // Update current line index to previous line
         cur_line = prev_line;
     }
     else // Cursor is in the middle or end of the line
@@ -123,10 +167,10 @@ void Document::delete_backward()
         cur_col--;
 
         // Delete the character at the new cursor position
-        std::string pre = utf8::substr(*cur_line, 0, cur_col);
-        std::string post = utf8::substr(*cur_line, cur_col + 1, utf8::str_length(*cur_line) - cur_col - 1);
-        *cur_line = pre + post;
+        size_t at = lines.byte_of_column(cur_line, cur_col);
+        lines.splice(cur_line, at, lines.byte_of_column(cur_line, cur_col + 1) - at, {});
     }
+    edit_version++;
     scroll_to_cursor();
 }
 
@@ -142,24 +186,47 @@ void Document::cursor_left()
     {
         cur_col--;
     }
-    else if (cur_line != lines.begin())
+    else if (paged)
+    {
+        if (cur_offset > 0)
+        {
+            cur_offset = paged->prev_line(cur_offset);
+            cur_col = paged_line_length();
+        }
+    }
+    else if (cur_line > 0)
     {
         cur_line--;
-        cur_col = utf8::str_length(*cur_line);
+        cur_col = lines.length(cur_line);
     }
     scroll_to_cursor();
 }
 
 void Document::cursor_right()
 {
-    if (cur_col < utf8::str_length(*cur_line))
+    if (paged)
+    {
+        if (cur_col < paged_line_length())
+        {
+            cur_col++;
+        }
+        else
+        {
+            uint64_t next_line = paged->next_line(cur_offset);
+            if (next_line < paged->size())
+            {
+                cur_offset = next_line;
+                cur_col = 0;
+            }
+        }
+    }
+    else if (cur_col < lines.length(cur_line))
     {
         cur_col++;
     }
     else
     {
-        auto next_line = std::next(cur_line);
-        if (next_line != lines.end())
+        if (cur_line + 1 < lines.size())
         {
             cur_line++;
             cur_col = 0;
@@ -170,7 +237,15 @@ void Document::cursor_right()
 
 void Document::cursor_up()
 {
-    if (cur_line != lines.begin())
+    if (paged)
+    {
+        if (cur_offset > 0)
+        {
+            cur_offset = paged->prev_line(cur_offset);
+            cur_col = std::min<size_t>(cur_col, paged_line_length());
+        }
+    }
+    else if (cur_line > 0)
     {
         // Store current column
         size_t old_col = cur_col;
@@ -179,15 +254,24 @@ void Document::cursor_up()
         --cur_line;
 
         // Reset cursor to old column or end of line if line is shorter
-        cur_col = old_col < utf8::str_length(*cur_line) ? old_col : utf8::str_length(*cur_line);
+        size_t length = lines.length(cur_line);
+        cur_col = old_col < length ? old_col : length;
     }
     scroll_to_cursor();
 }
 
 void Document::cursor_down()
 {
-    auto next_line = std::next(cur_line);
-    if (next_line != lines.end())
+    if (paged)
+    {
+        uint64_t next_line = paged->next_line(cur_offset);
+        if (next_line < paged->size())
+        {
+            cur_offset = next_line;
+            cur_col = std::min<size_t>(cur_col, paged_line_length());
+        }
+    }
+    else if (cur_line + 1 < lines.size())
     {
         // Store current column
         size_t old_col = cur_col;
@@ -196,7 +280,8 @@ void Document::cursor_down()
         cur_line++;
 
         // Reset cursor to old column or end of line if line is shorter
-        cur_col = old_col < utf8::str_length(*cur_line) ? old_col : utf8::str_length(*cur_line);
+        size_t length = lines.length(cur_line);
+        cur_col = old_col < length ? old_col : length;
     }
     scroll_to_cursor();
 }
@@ -211,42 +296,59 @@ void Document::cursor_home()
 void Document::cursor_end()
 {
     // Move the cursor to the end of the current line
-    cur_col = utf8::str_length(*cur_line);
+    cur_col = paged ? paged_line_length() : lines.length(cur_line);
     scroll_to_cursor();
 }
 
 void Document::print()
 {
+    if (paged)
+    {
+        print_paged();
+        return;
+    }
+
     // Clear the screen
     erase();
 
     int line_number = 0;
-    for (auto str = std::next(lines.begin(), scroll_offset.first); str != lines.end() && line_number < getmaxy(stdscr); ++str)
+    for (size_t i = scroll_offset.first; i < lines.size() && line_number < getmaxy(stdscr); ++i)
     {
-        // Calculate the length of the substring
-        int sub_len = getmaxx(stdscr) < utf8::str_length(*str) - scroll_offset.second ? getmaxx(stdscr) : utf8::str_length(*str) - scroll_offset.second;
+        // Start at the first visible character without counting through the ones scrolled off to the left
+        size_t length = lines.length(i);
+        if (length > (size_t)scroll_offset.second)
+        {
+            // Calculate the length of the substring
+            size_t sub_len = std::min<size_t>(getmaxx(stdscr), length - scroll_offset.second);
+            size_t start = lines.byte_of_column(i, scroll_offset.second);
+            std::string str = lines.text(i, start, lines.byte_of_column(i, scroll_offset.second + sub_len) - start);
 
-        // Print the line with the correct substring
-        mvprintw(line_number, 0, utf8::substr(*str, scroll_offset.second, sub_len).c_str());
+            // Print the line with the correct substring
+            mvprintw(line_number, 0, utf8::substr(str, 0, sub_len).c_str());
+        }
         line_number++;
     }
 
 
     // Manually draw the cursor
-    if (cur_line != lines.end())
+    if (cur_line < lines.size())
     {
+        // Only the visible part of the line is measured, so that the cost doesn't grow with the cursor column
+        size_t start = lines.byte_of_column(cur_line, scroll_offset.second);
+        size_t end = lines.byte_of_column(cur_line, scroll_offset.second + getmaxx(stdscr));
+        std::string visible = lines.text(cur_line, start, end - start);
         attron(A_REVERSE);
-        int char_index = utf8::terminal_to_char_index(*cur_line, cur_col);
-        if (char_index < utf8::str_length(*cur_line))
+        size_t char_index = utf8::terminal_to_char_index(visible, cur_col - scroll_offset.second);
+        if (scroll_offset.second + char_index < lines.length(cur_line))
         {
             // Draw the cursor on an existing character
-            std::string cursor_str = utf8::substr(*cur_line, char_index, 1);
-            mvprintw(std::distance(lines.begin(), cur_line) - scroll_offset.first, cur_col - scroll_offset.second, cursor_str.c_str());
+            std::string cursor_str = utf8::substr(visible, char_index, 1);
+            mvprintw(cur_line - scroll_offset.first, cur_col - scroll_offset.second, cursor_str.c_str());
         }
         else
         {
             // Draw the cursor at the end of the line
-            mvprintw(std::distance(lines.begin(), cur_line) - scroll_offset.first, cur_col - scroll_offset.second, " ");
+            mvprintw(cur_line - scroll_offset.first, cur_col - scroll_offset.second, " ");
         }
         attroff(A_REVERSE);
     }
@@ -254,23 +356,30 @@ void Document::print()
 
 void Document::set_selection_start()
 {
-    selection_start = std::make_pair(std::distance(lines.begin(), cur_line), cur_col);
+    selection_start = std::make_pair(cur_line, cur_col);
     selecting = true;
 }
 
 void Document::scroll_to_cursor()
 {
-    int cursor_line = std::distance(lines.begin(), cur_line);
-
-    // check if the cursor line is above the top of the view
-    if (cursor_line < scroll_offset.first)
+    if (paged)
     {
-        scroll_offset.first = cursor_line;
+        scroll_paged_to_cursor_line();
     }
-    // check if the cursor line is below the bottom of the view
-    else if (cursor_line >= scroll_offset.first + getmaxy(stdscr))
+    else
     {
-        scroll_offset.first = cursor_line - getmaxy(stdscr) + 1;
+        int cursor_line = cur_line;
+
+        // check if the cursor line is above the top of the view
+        if (cursor_line < scroll_offset.first)
+        {
+            scroll_offset.first = cursor_line;
+        }
+        // check if the cursor line is below the bottom of the view
+        else if (cursor_line >= scroll_offset.first + getmaxy(stdscr))
+        {
+            scroll_offset.first = cursor_line - getmaxy(stdscr) + 1;
+        }
     }
 
     // check if the cursor column is to the left of the view
@@ -284,3 +393,281 @@ void Document::scroll_to_cursor()
         scroll_offset.second = cur_col - getmaxx(stdscr) + 1;
     }
 }
+
+bool Document::read_only() const
+{
+    return paged != nullptr;
+}
+
+uint64_t Document::version() const
+{
+    return edit_version;
+}
+
+size_t Document::cursor_line() const
+{
+    return cur_line;
+}
+
+size_t Document::cursor_column() const
+{
+    return cur_col;
+}
+
+size_t Document::top_line() const
+{
+    return scroll_offset.first;
+}
+
+DocumentSnapshot Document::snapshot() const
+{
+    return {lines, edit_version};
+}
+
+const std::string& Document::file_name() const
+{
+    return filename;
+}
+
+ReloadPlan Document::plan_reload(const std::string& filename, const DocumentSnapshot& snapshot,
+                                 const CancellationToken& token)
+{
+    ReloadPlan plan;
+    plan.arena = std::make_shared<TextArena>();
+    plan.lines = read_lines(filename, *plan.arena);
+
+    // Long lines aren't held in one piece, so they are copied out for the diff
+    TextArena scratch;
+    std::vector<std::string_view> current;
+    current.reserve(snapshot.lines.size());
+    for (size_t i = 0; i < snapshot.lines.size(); i++)
+        current.push_back(snapshot.lines.view(i, scratch));
+
+    plan.hunks = diff_lines(current, plan.lines, token);
+    return plan;
+}
+
+void Document::apply_reload(const ReloadPlan& plan)
+{
+    if (paged || plan.hunks.empty())
+        return;
+
+    // Apply the hunks bottom up so that the line numbers of the ones still to do stay valid
+    for (auto hunk = plan.hunks.rbegin(); hunk != plan.hunks.rend(); ++hunk)
+    {
+        for (size_t i = 0; i < hunk->old_count; i++)
+            lines.erase(hunk->old_start);
+        for (size_t i = 0; i < hunk->new_count; i++)
+            lines.insert(hunk->old_start + i, plan.lines[hunk->new_start + i]);
+    }
+
+    // Keep the cursor, view and selection on the same text where it survived, or at the start of what replaced it
+    cur_line = reloaded_line(plan.hunks, cur_line);
+    cur_col = std::min<size_t>(cur_col, lines.length(cur_line));
+    scroll_offset.first = reloaded_line(plan.hunks, scroll_offset.first);
+    if (selecting)
+        selection_start.first = reloaded_line(plan.hunks, selection_start.first);
+
+    edit_version++;
+    scroll_to_cursor();
+}
+
+size_t Document::reloaded_line(const std::vector<DiffHunk>& hunks, size_t line) const
+{
+    long delta = 0;
+    for (const auto& hunk : hunks)
+    {
+        if (line < hunk.old_start)
+            break;
+
+        // Inside a replaced range, stay at the same distance into the replacement if it is long enough
+        if (line < hunk.old_start + hunk.old_count)
+        {
+            size_t into = std::min(line - hunk.old_start, hunk.new_count > 0 ? hunk.new_count - 1 : 0);
+            return std::min(hunk.new_start + into, lines.size() - 1);
+        }
+        delta = (long)(hunk.new_start + hunk.new_count) - (long)(hunk.old_start + hunk.old_count);
+    }
+    return std::min<size_t>(line + delta, lines.size() - 1);
+}
+
+void Document::jump_to_percent(int percent)
+{
+    if (!paged)
+    {
+        percent = std::clamp(percent, 0, 100);
+        jump_to_line((lines.size() - 1) * percent / 100);
+        return;
+    }
+
+    // Put the target line at the top of the view
+    cur_offset = paged->offset_of_percent(percent);
+    top_offset = cur_offset;
+    cur_col = 0;
+    scroll_to_cursor();
+}
+
+void Document::jump_to_line(uint64_t line)
+{
+    if (paged)
+    {
+        cur_offset = paged->offset_of_line(line);
+        top_offset = cur_offset;
+    }
+    else
+    {
+        cur_line = std::min<uint64_t>(line, lines.size() - 1);
+    }
+    cur_col = 0;
+    scroll_to_cursor();
+}
+
+void Document::jump_to_matching_bracket()
+{
+    if (paged)
+        return;
+
+    size_t at = lines.byte_of_column(cur_line, cur_col);
+    if (at >= lines.bytes(cur_line))
+        return;
+
+    int change = brackets::depth_change(lines.text(cur_line, at, 1)[0]);
+    if (change > 0)
+        jump_to_bracket_forward(at + 1, 0);
+    else if (change < 0)
+        jump_to_bracket_backward(at, 0);
+}
+
+void Document::jump_to_enclosing_block()
+{
+    if (paged)
+        return;
+
+    jump_to_bracket_backward(lines.byte_of_column(cur_line, cur_col), 0);
+}
+
+// Moves the cursor to the first bracket after byte from of the cursor line which takes depth below zero
+void Document::jump_to_bracket_forward(size_t from, int64_t depth)
+{
+    size_t row = cur_line;
+    size_t found = lines.scan_bracket_forward(row, from, depth);
+    if (found == std::string_view::npos)
+    {
+        // The tree finds the line holding the match without looking at the lines in between
+        row = lines.find_bracket_forward(row + 1, depth);
+        if (row == lines.size())
+            return;
+        found = lines.scan_bracket_forward(row, 0, depth);
+    }
+    move_cursor_to(row, found);
+}
+
+// Moves the cursor to the last bracket before byte to of the cursor line which takes depth above zero
+void Document::jump_to_bracket_backward(size_t to, int64_t depth)
+{
+    size_t row = cur_line;
+    size_t found = lines.scan_bracket_backward(row, to, depth);
+    if (found == std::string_view::npos)
+    {
+        row = lines.find_bracket_backward(row, depth);
+        if (row == lines.size())
+            return;
+        found = lines.scan_bracket_backward(row, lines.bytes(row), depth);
+    }
+    move_cursor_to(row, found);
+}
+
+void Document::move_cursor_to(size_t line, size_t byte)
+{
+    if (byte == std::string_view::npos)
+        return;
+
+    cur_line = line;
+    cur_col = lines.column_of_byte(line, byte);
+    scroll_to_cursor();
+}
+
+std::string Document::paged_line(uint64_t offset)
+{
+    return paged->read_line(offset, MAX_LINE_BYTES);
+}
+
+size_t Document::paged_line_length()
+{
+    return utf8::str_length(paged_line(cur_offset));
+}
+
+void Document::print_paged()
+{
+    // Clear the screen
+    erase();
+
+    // Only read as much of each line as can be visible; a UTF-8 character is at most 4 bytes
+    int width = getmaxx(stdscr);
+    size_t visible_bytes = (size_t)(scroll_offset.second + width) * 4;
+
+    int cursor_row = -1;
+    std::string cursor_text;
+    uint64_t offset = top_offset;
+    for (int row = 0; row < getmaxy(stdscr); row++)
+    {
+        std::string line = paged->read_line(offset, visible_bytes);
+        if (utf8::str_length(line) > scroll_offset.second)
+            mvprintw(row, 0, "%s", utf8::substr(line, scroll_offset.second, width).c_str());
+
+        if (offset == cur_offset)
+        {
+            cursor_row = row;
+            cursor_text = line;
+        }
+
+        uint64_t next = paged->next_line(offset);
+        if (next >= paged->size())
+            break;
+        offset = next;
+    }
+
+    // Manually draw the cursor
+    if (cursor_row >= 0)
+    {
+        attron(A_REVERSE);
+        int char_index = utf8::terminal_to_char_index(cursor_text, cur_col);
+        if (char_index < utf8::str_length(cursor_text))
+        {
+            // Draw the cursor on an existing character
+            std::string cursor_str = utf8::substr(cursor_text, char_index, 1);
+            mvprintw(cursor_row, cur_col - scroll_offset.second, "%s", cursor_str.c_str());
+        }
+        else
+        {
+            // Draw the cursor at the end of the line
+            mvprintw(cursor_row, cur_col - scroll_offset.second, " ");
+        }
+        attroff(A_REVERSE);
+    }
+}
+
+void Document::scroll_paged_to_cursor_line()
+{
+    int height = getmaxy(stdscr);
+
+    // check if the cursor line is above the top of the view
+    if (cur_offset < top_offset)
+    {
+        top_offset = cur_offset;
+        return;
+    }
+
+    // Walk at most one screen of lines down from the top of the view looking for the cursor line
+    uint64_t offset = top_offset;
+    for (int row = 1; row < height && offset < cur_offset; row++)
+        offset = paged->next_line(offset);
+
+    // The cursor line is below the bottom of the view, so make it the last visible line
+    if (offset < cur_offset)
+    {
+        top_offset = cur_offset;
+        for (int row = 1; row < height && top_offset > 0; row++)
+            top_offset = paged->prev_line(top_offset);
+    }
+}
@@ -1,17 +1,48 @@
 #ifndef DOCUMENT_H
 #define DOCUMENT_H
 
-#include <list>
+#include "diff.h"
+#include "line_tree.h"
+#include "paged_file.h"
+#include <memory>
 #include <string>
+#include <vector>
+
+// Point-in-time copy of a document's text. It shares structure with the document, so taking one is cheap, and it
+// can be read from any thread without locking while the document goes on being edited. Editing a snapshot first
+// moves its text to an arena of its own, so that doesn't race with the document either.
+struct DocumentSnapshot
+{
+    LineTree lines;
+    uint64_t version;
+};
+
+// New contents of a document's file and the hunks that turn the document's text into them.
+struct ReloadPlan
+{
+    std::shared_ptr<TextArena> arena;
+    std::vector<std::string_view> lines;
+    std::vector<DiffHunk> hunks;
+};
 
 class Document
 {
-    std::list<std::string> lines;
-    std::list<std::string>::iterator cur_line;
+    std::string filename;
+    LineTree lines;
+    size_t cur_line;
     size_t cur_col;
     std::pair<int, int> selection_start;
     std::pair<int, int> scroll_offset;
 
+    // Incremented by every edit so that background results computed against older text can be recognised
+    uint64_t edit_version = 0;
+
+    // Very large files are viewed read-only through a bounded page cache instead of being loaded. In that mode
+    // lines is unused and the cursor line and first visible line are tracked as byte offsets of line starts.
+    std::unique_ptr<PagedFile> paged;
+    uint64_t cur_offset = 0;
+    uint64_t top_offset = 0;
+
   public:
     Document();
     explicit Document(const std::string &filename);
@@ -27,10 +58,44 @@ class Document
     void print();
     void set_selection_start();
     void clear_selection();
+    bool read_only() const;
+    uint64_t version() const;
+    size_t cursor_line() const;
+    size_t cursor_column() const;
+
+    // Index of the first line on screen. Unused in paged mode, which tracks the top of the view by offset.
+    size_t top_line() const;
+    DocumentSnapshot snapshot() const;
+    const std::string& file_name() const;
+    void jump_to_percent(int percent);
+    void jump_to_line(uint64_t line);
+
+    // Moves the cursor from a bracket to the bracket that matches it.
+    void jump_to_matching_bracket();
+
+    // Moves the cursor to the opening bracket of the innermost block around it.
+    void jump_to_enclosing_block();
+
+    // Reads filename and diffs it against snapshot. Safe to call from any thread.
+    static ReloadPlan plan_reload(const std::string& filename, const DocumentSnapshot& snapshot,
+                                  const CancellationToken& token);
+
+    // Applies a plan made against the current version as a minimal set of line edits, keeping the cursor, view
+    // and selection on the text they were on.
+    void apply_reload(const ReloadPlan& plan);
+
     bool selecting = false;
 
   private:
     void scroll_to_cursor();
+    std::string paged_line(uint64_t offset);
+    size_t paged_line_length();
+    void print_paged();
+    void scroll_paged_to_cursor_line();
+    size_t reloaded_line(const std::vector<DiffHunk>& hunks, size_t line) const;
+    void jump_to_bracket_forward(size_t from, int64_t depth);
+    void jump_to_bracket_backward(size_t to, int64_t depth);
+    void move_cursor_to(size_t line, size_t byte);
 };
 
 #endif
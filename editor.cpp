@@ -1,4 +1,5 @@
 #include "editor.h"
+#include <algorithm>
 #include <clocale>
 #include <cctype>
 
@@ -11,12 +12,22 @@
 #define CTRL_K 11
 #define ESC 27
 
-Editor::Editor() : doc("../document.cpp")
+// Redraws are coalesced so that the screen is repainted at most once per frame
+static const std::chrono::milliseconds FRAME_INTERVAL(16);
+
+// How often the file is checked for changes made outside the editor
+static const std::chrono::milliseconds FILE_WATCH_INTERVAL(1000);
+
+Editor::Editor(const std::string& filename) : doc(filename)
 {
+    std::error_code ec;
+    disk_time = std::filesystem::last_write_time(filename, ec);
 }
 
 Editor::~Editor()
 {
+    // Let a reload still reading or diffing the file give up, so that joining the pool doesn't wait for it
+    reload_token.cancel();
     endwin();
 }
 
@@ -36,80 +47,236 @@ void Editor::init()
 
 void Editor::run()
 {
-    doc.print();
-    refresh();
+    nodelay(stdscr, TRUE); // input is read when the event loop reports it, so getch must never block
+
+    loop.set_input_handler([this] { read_input(); });
+    if (!doc.read_only())
+        loop.add_timer(FILE_WATCH_INTERVAL, [this] { watch_file(); });
+    redraw();
+    loop.run();
+}
+
+void Editor::read_input()
+{
+    // Drain every pending keystroke before drawing so that fast typing or key repeat results in a single repaint
+    bool handled = false;
+    int ch;
+    while ((ch = getch()) != ERR)
+    {
+        if (!handle_key(ch))
+        {
+            loop.stop();
+            return;
+        }
+        handled = true;
+    }
+
+    if (handled)
+        request_redraw();
+}
 
-    while (true)
+bool Editor::handle_key(int ch)
+{
+    if (prompting_line)
+    {
+        handle_line_prompt_key(ch);
+        return true;
+    }
+
+    switch (ch)
     {
-        MEVENT event;
-        int ch = getch();
+    case KEY_CTRL('q'):
+        return false;
+    case KEY_LEFT:
+        doc.cursor_left();
+        break;
+    case KEY_RIGHT:
+        doc.cursor_right();
+        break;
+    case KEY_UP:
+        doc.cursor_up();
+        break;
+    case KEY_DOWN:
+        doc.cursor_down();
+        break;
+    case KEY_HOME:
+        doc.cursor_home();
+        break;
+    case KEY_END:
+        doc.cursor_end();
+        break;
+    case KEY_BACKSPACE:
+        doc.delete_backward();
+        break;
+    case KEY_DC: // DEL key
+        doc.delete_forward();
+        break;
+    case KEY_CTRL('c'):
+        // TODO: Copy
+        break;
+    case KEY_CTRL('v'):
+        // TODO: Paste
+        break;
+    case KEY_CTRL('x'):
+        // TODO: Cut
+        break;
+    case KEY_CTRL('z'):
+        // TODO: Undo
+        break;
+    case KEY_CTRL('y'):
+        // TODO: Redo
+        break;
+    case ESC:
+        // The rest of an Alt combination may not have arrived yet, so wait for it rather than dropping it
+        timeout(ESCDELAY);
+        ch = getch();
+        nodelay(stdscr, TRUE);
         switch (ch)
         {
-        case KEY_CTRL('q'):
-            goto end;
-        case KEY_LEFT:
-            doc.cursor_left();
-            break;
-        case KEY_RIGHT:
-            doc.cursor_right();
-            break;
-        case KEY_UP:
-            doc.cursor_up();
-            break;
-        case KEY_DOWN:
-            doc.cursor_down();
+        case 's':
+            doc.set_selection_start();
             break;
-        case KEY_HOME:
-            doc.cursor_home();
+        case 'x':
+            doc.clear_selection();
             break;
-        case KEY_END:
-            doc.cursor_end();
+        case 'r':
+            reload();
             break;
-        case KEY_BACKSPACE:
-            doc.delete_backward();
+        case 'm':
+            doc.jump_to_matching_bracket();
             break;
-        case KEY_DC: // DEL key
-            doc.delete_forward();
+        case 'u':
+            doc.jump_to_enclosing_block();
             break;
-        case KEY_CTRL('c'):
-            // TODO: Copy
+        case 'g':
+            prompting_line = true;
+            line_input.clear();
             break;
-        case KEY_CTRL('v'):
-            // TODO: Paste
-            break;
-        case KEY_CTRL('x'):
-            // TODO: Cut
-            break;
-        case KEY_CTRL('z'):
-            // TODO: Undo
-            break;
-        case KEY_CTRL('y'):
-            // TODO: Redo
-            break;
-        case ESC:
-            ch = getch();
-            switch (ch)
-            {
-            case 's':
-                doc.set_selection_start();
-                break;
-            case 'x':
-                doc.clear_selection();
-                break;
-            default:
-                // ignore
-                break;
-            }
-        case KEY_RESIZE:
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+            // Jump to 0%, 10%, ... 90% of the file; other percentages go through the go to line prompt as N%
+            doc.jump_to_percent((ch - '0') * 10);
             break;
         default:
-            if (ch >= 0 && ch <= 255 && (isprint(ch) || ch == '\n' || ch == '\t'))
-                doc.insert((char)ch);
+            // ignore
             break;
         }
+    case KEY_RESIZE:
+        break;
+    default:
+        if (ch >= 0 && ch <= 255 && (isprint(ch) || ch == '\n' || ch == '\t'))
+            doc.insert((char)ch);
+        break;
+    }
+    return true;
+}
+
+void Editor::handle_line_prompt_key(int ch)
+{
+    switch (ch)
+    {
+    case '\n':
+    case KEY_ENTER:
+        // Line numbers are typed one-based; in a read-only file the target is approximate until it has been indexed.
+        // A trailing % jumps to that percentage of the file instead.
+        prompting_line = false;
+        if (!line_input.empty() && line_input.back() == '%')
+        {
+            if (line_input.size() > 1)
+                doc.jump_to_percent((int)std::min<uint64_t>(100, std::stoull(line_input)));
+        }
+        else if (!line_input.empty())
+        {
+            doc.jump_to_line(std::max<uint64_t>(1, std::stoull(line_input)) - 1);
+        }
+        break;
+    case ESC:
+    case KEY_CTRL('g'):
+        prompting_line = false;
+        break;
+    case KEY_BACKSPACE:
+    case 127:
+        if (!line_input.empty())
+            line_input.pop_back();
+        break;
+    default:
+        // Digits, optionally followed by a single %
+        if (!line_input.empty() && line_input.back() == '%')
+            break;
+        if (ch >= '0' && ch <= '9' && line_input.size() < 18)
+            line_input += (char)ch;
+        else if (ch == '%' && !line_input.empty())
+            line_input += (char)ch;
+        break;
+    }
+}
+
+void Editor::request_redraw()
+{
+    if (redraw_pending)
+        return;
+    redraw_pending = true;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(EventLoop::Clock::now() - last_redraw);
+    auto delay = elapsed >= FRAME_INTERVAL ? std::chrono::milliseconds(0) : FRAME_INTERVAL - elapsed;
+    loop.add_timer(delay, [this] { redraw(); });
+}
+
+void Editor::redraw()
+{
+    redraw_pending = false;
+    last_redraw = EventLoop::Clock::now();
+    doc.print();
+    if (prompting_line)
+    {
+        mvprintw(getmaxy(stdscr) - 1, 0, "Go to line: %s", line_input.c_str());
+        clrtoeol();
+    }
+    refresh();
+}
+
+void Editor::reload()
+{
+    // There is no undo, so never let the file's contents replace edits that haven't been saved
+    if (doc.read_only() || doc.version() != clean_version)
+        return;
+
+    // A newer reload supersedes one still in progress
+    reload_token.cancel();
+    reload_token = CancellationToken();
+
+    // Diff against a snapshot on a worker; the result is dropped if the buffer is edited before it arrives
+    DocumentSnapshot snapshot = doc.snapshot();
+    std::string filename = doc.file_name();
+    run_in_background<ReloadPlan>(
+        reload_token,
+        [snapshot, filename](const CancellationToken& token) {
+            return Document::plan_reload(filename, snapshot, token);
+        },
+        [this](ReloadPlan& plan) {
+            doc.apply_reload(plan);
+            clean_version = doc.version();
+        });
+}
+
+void Editor::watch_file()
+{
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(doc.file_name(), ec);
+    if (!ec && time != disk_time)
+    {
+        disk_time = time;
 
-        doc.print();
+        // Only follows the file while the buffer has no edits of its own
+        reload();
     }
-end:
-    return;
+    loop.add_timer(FILE_WATCH_INTERVAL, [this] { watch_file(); });
 }
@@ -1,19 +1,67 @@
 #ifndef EDITOR_H
 #define EDITOR_H
 
+#include "background.h"
 #include "document.h"
+#include "event_loop.h"
+#include "thread_pool.h"
+#include <filesystem>
 #include <ncurses.h>
+#include <string>
 
 class Editor
 {
   private:
     Document doc;
+    EventLoop loop;
+    bool redraw_pending = false;
+    EventLoop::Clock::time_point last_redraw;
+
+    // Modification time of the file when last checked, and the document version that matches its contents
+    std::filesystem::file_time_type disk_time;
+    uint64_t clean_version = 0;
+    CancellationToken reload_token;
+
+    // Line number, or percentage ending in %, typed so far at the go to line prompt, which is shown on the bottom row
+    // while prompting is set
+    bool prompting_line = false;
+    std::string line_input;
+
+    // Declared last so that its workers are joined before the document and event loop they report to go away
+    ThreadPool pool;
 
   public:
-    Editor();
+    explicit Editor(const std::string& filename);
     ~Editor();
     void init();
     void run();
+
+  private:
+    void read_input();
+    bool handle_key(int ch);
+    void handle_line_prompt_key(int ch);
+    void request_redraw();
+    void redraw();
+    void reload();
+    void watch_file();
+
+    template <typename Result>
+    void run_in_background(const CancellationToken& token, std::function<Result(const CancellationToken&)> work,
+                           std::function<void(Result&)> apply);
 };
 
+// Runs work on the thread pool without blocking input, then hands its result to apply on the UI thread and redraws.
+// The result is discarded if token was cancelled or the document was edited after the job was submitted.
+template <typename Result>
+void Editor::run_in_background(const CancellationToken& token, std::function<Result(const CancellationToken&)> work,
+                               std::function<void(Result&)> apply)
+{
+    ::run_in_background<Result>(
+        pool, loop, token, [this] { return doc.version(); }, work,
+        [this, apply](Result& result) {
+            apply(result);
+            request_redraw();
+        });
+}
+
 #endif
@@ -0,0 +1,125 @@
+#include "event_loop.h"
+#include <algorithm>
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop()
+{
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+EventLoop::~EventLoop()
+{
+    if (wakeup_fd >= 0)
+        close(wakeup_fd);
+}
+
+void EventLoop::set_input_handler(std::function<void()> handler)
+{
+    input_handler = std::move(handler);
+}
+
+uint64_t EventLoop::add_timer(std::chrono::milliseconds delay, std::function<void()> callback)
+{
+    uint64_t id = next_timer_id++;
+    timers.push_back({id, Clock::now() + delay, std::move(callback)});
+    return id;
+}
+
+void EventLoop::cancel_timer(uint64_t id)
+{
+    timers.erase(std::remove_if(timers.begin(), timers.end(), [id](const Timer& timer) { return timer.id == id; }),
+                 timers.end());
+}
+
+void EventLoop::post(std::function<void()> callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        posted.push_back(std::move(callback));
+    }
+
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeup_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void EventLoop::run()
+{
+    running = true;
+    while (running)
+    {
+        pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wakeup_fd, POLLIN, 0}};
+        int ready = poll(fds, 2, poll_timeout());
+
+        // A signal such as SIGWINCH interrupts poll; let the input handler pick up whatever curses queued for it
+        if (ready < 0 && errno == EINTR && input_handler)
+            input_handler();
+
+        if (ready > 0 && (fds[0].revents & (POLLIN | POLLHUP)) && input_handler)
+            input_handler();
+
+        if (ready > 0 && (fds[1].revents & POLLIN))
+        {
+            uint64_t count;
+            ssize_t ignored = read(wakeup_fd, &count, sizeof(count));
+            (void)ignored;
+            run_posted();
+        }
+
+        run_expired_timers();
+    }
+}
+
+void EventLoop::stop()
+{
+    running = false;
+}
+
+int EventLoop::poll_timeout() const
+{
+    if (timers.empty())
+        return -1;
+
+    auto deadline = std::min_element(timers.begin(), timers.end(), [](const Timer& a, const Timer& b) {
+                        return a.deadline < b.deadline;
+                    })->deadline;
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+    return std::max<int>(0, remaining.count());
+}
+
+void EventLoop::run_posted()
+{
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        callbacks.swap(posted);
+    }
+
+    for (auto& callback : callbacks)
+        callback();
+}
+
+void EventLoop::run_expired_timers()
+{
+    // Collect first, since a callback may add or cancel timers
+    auto now = Clock::now();
+    std::vector<Timer> expired;
+    for (auto it = timers.begin(); it != timers.end();)
+    {
+        if (it->deadline <= now)
+        {
+            expired.push_back(std::move(*it));
+            it = timers.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for (auto& timer : expired)
+        timer.callback();
+}
@@ -0,0 +1,59 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Single threaded event loop which waits on terminal input, timers and callbacks posted from other threads. Every
+// callback runs on the thread that called run().
+class EventLoop
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+  private:
+    struct Timer
+    {
+        uint64_t id;
+        Clock::time_point deadline;
+        std::function<void()> callback;
+    };
+
+    int wakeup_fd;
+    std::function<void()> input_handler;
+    std::vector<Timer> timers;
+    uint64_t next_timer_id = 1;
+    bool running = false;
+
+    std::mutex posted_mutex;
+    std::vector<std::function<void()>> posted;
+
+  public:
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Sets the callback invoked whenever standard input is readable.
+    void set_input_handler(std::function<void()> handler);
+
+    // Runs callback once after delay. Returns an id which can be passed to cancel_timer.
+    uint64_t add_timer(std::chrono::milliseconds delay, std::function<void()> callback);
+    void cancel_timer(uint64_t id);
+
+    // Queues callback to run on the loop thread and wakes the loop. Safe to call from any thread.
+    void post(std::function<void()> callback);
+
+    void run();
+    void stop();
+
+  private:
+    int poll_timeout() const;
+    void run_posted();
+    void run_expired_timers();
+};
+
+#endif
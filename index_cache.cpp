@@ -0,0 +1,139 @@
+#include "index_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <unistd.h>
+
+// Number of bytes hashed at each end of the file
+static const size_t HASH_BYTES = 64 * 1024;
+
+static const char MAGIC[8] = {'T', 'E', 'I', 'D', 'X', '0', '0', '1'};
+
+// Cache files live in $XDG_CACHE_HOME/te (or ~/.cache/te), named after a hash of the indexed file's absolute path
+static std::filesystem::path cache_path(const std::string& filename)
+{
+    std::filesystem::path dir;
+    if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        dir = xdg;
+    else if (const char* home = getenv("HOME"); home && *home)
+        dir = std::filesystem::path(home) / ".cache";
+    else
+        return {};
+
+    std::error_code ec;
+    std::string key = std::filesystem::absolute(filename, ec).string();
+    char name[32];
+    snprintf(name, sizeof(name), "%016zx.idx", std::hash<std::string>{}(key));
+    return dir / "te" / name;
+}
+
+// 64-bit FNV-1a
+static uint64_t hash_range(int fd, uint64_t offset, size_t length)
+{
+    std::string buffer(length, '\0');
+    ssize_t n = pread(fd, &buffer[0], length, offset);
+    if (n < 0)
+        n = 0;
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (ssize_t i = 0; i < n; i++)
+    {
+        hash ^= (unsigned char)buffer[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void index_cache::hash_file(int fd, IndexCacheEntry& entry)
+{
+    size_t length = entry.file_size < HASH_BYTES ? entry.file_size : HASH_BYTES;
+    entry.head_hash = hash_range(fd, 0, length);
+    entry.tail_hash = hash_range(fd, entry.file_size - length, length);
+}
+
+bool index_cache::load(const std::string& filename, uint64_t file_size, IndexCacheEntry& entry)
+{
+    auto path = cache_path(filename);
+    if (path.empty())
+        return false;
+
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    uint64_t checkpoint_count = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&entry.file_size), sizeof(entry.file_size));
+    file.read(reinterpret_cast<char*>(&entry.mtime_ns), sizeof(entry.mtime_ns));
+    file.read(reinterpret_cast<char*>(&entry.head_hash), sizeof(entry.head_hash));
+    file.read(reinterpret_cast<char*>(&entry.tail_hash), sizeof(entry.tail_hash));
+    file.read(reinterpret_cast<char*>(&entry.lines), sizeof(entry.lines));
+    file.read(reinterpret_cast<char*>(&checkpoint_count), sizeof(checkpoint_count));
+    if (!file || !std::equal(magic, magic + sizeof(magic), MAGIC))
+        return false;
+
+    // Check the counts before allocating anything, so a corrupt cache file can't ask for more than the real file
+    // could need: one checkpoint per LINES_PER_CHECKPOINT lines, the last of which may fall at the end of the file
+    if (entry.file_size > file_size || entry.lines > entry.file_size)
+        return false;
+    uint64_t full = entry.lines / LINES_PER_CHECKPOINT;
+    if (checkpoint_count == 0 || checkpoint_count > full + 1 || checkpoint_count < full)
+        return false;
+
+    entry.checkpoints.resize(checkpoint_count);
+    file.read(reinterpret_cast<char*>(entry.checkpoints.data()), checkpoint_count * sizeof(uint64_t));
+    if (!file || entry.checkpoints[0] != 0)
+        return false;
+
+    // Checkpoints are line starts, so they must increase and lie inside the indexed part of the file
+    for (size_t i = 1; i < entry.checkpoints.size(); i++)
+    {
+        if (entry.checkpoints[i] <= entry.checkpoints[i - 1] || entry.checkpoints[i] >= entry.file_size)
+            return false;
+    }
+    return true;
+}
+
+void index_cache::store(const std::string& filename, const IndexCacheEntry& entry)
+{
+    auto path = cache_path(filename);
+    if (path.empty())
+        return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::string data;
+    uint64_t checkpoint_count = entry.checkpoints.size();
+    data.append(MAGIC, sizeof(MAGIC));
+    data.append(reinterpret_cast<const char*>(&entry.file_size), sizeof(entry.file_size));
+    data.append(reinterpret_cast<const char*>(&entry.mtime_ns), sizeof(entry.mtime_ns));
+    data.append(reinterpret_cast<const char*>(&entry.head_hash), sizeof(entry.head_hash));
+    data.append(reinterpret_cast<const char*>(&entry.tail_hash), sizeof(entry.tail_hash));
+    data.append(reinterpret_cast<const char*>(&entry.lines), sizeof(entry.lines));
+    data.append(reinterpret_cast<const char*>(&checkpoint_count), sizeof(checkpoint_count));
+    data.append(reinterpret_cast<const char*>(entry.checkpoints.data()), checkpoint_count * sizeof(uint64_t));
+
+    // Write to a temporary file of our own and rename it into place, so that neither a concurrent reader nor another
+    // instance saving the same index at the same time can leave a partial or interleaved index behind
+    std::string temp = path.string() + ".XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0)
+        return;
+
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (close(fd) != 0 || done < data.size())
+    {
+        std::filesystem::remove(temp, ec);
+        return;
+    }
+    std::filesystem::rename(temp, path, ec);
+}
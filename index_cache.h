@@ -0,0 +1,37 @@
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Line index of a large file as saved on disk, so that reopening the file doesn't require scanning it again.
+struct IndexCacheEntry
+{
+    uint64_t file_size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t head_hash = 0; // hash of the first bytes of the file
+    uint64_t tail_hash = 0; // hash of the last bytes before file_size
+    uint64_t lines = 0;     // newlines in the first file_size bytes
+    std::vector<uint64_t> checkpoints;
+};
+
+namespace index_cache
+{
+
+// Number of lines between checkpoints. Part of the cache format, since a cached index is only usable at this spacing.
+constexpr uint64_t LINES_PER_CHECKPOINT = 1024;
+
+// Loads the cached index for filename, which is now file_size bytes long. Returns false if there is none, it can't
+// be read, or it doesn't describe a prefix of a file that size.
+bool load(const std::string& filename, uint64_t file_size, IndexCacheEntry& entry);
+
+// Saves the index for filename, replacing any previous one. Failures are ignored; the cache is only an optimisation.
+void store(const std::string& filename, const IndexCacheEntry& entry);
+
+// Fills in the hashes of entry from the file open as fd, for a file of entry.file_size bytes.
+void hash_file(int fd, IndexCacheEntry& entry);
+
+} // namespace index_cache
+
+#endif
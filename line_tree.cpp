@@ -0,0 +1,611 @@
+#include "line_tree.h"
+#include <algorithm>
+
+// Maximum number of lines in a leaf and of children in an internal node
+static const size_t MAX_ENTRIES = 64;
+
+// Lines at least this long are held as blocks, so that an edit or a search within one doesn't copy or rescan the
+// whole line
+static const size_t LONG_LINE_BYTES = 64 * 1024;
+
+// Edits leave the old text of a line behind in the arena. Once the arena holds more than this much beyond twice the
+// live text, the live text is copied into a fresh arena.
+static const size_t COMPACT_SLACK = 1024 * 1024;
+
+LineTree::LineTree() : root(std::make_shared<Node>()), arena(std::make_shared<TextArena>())
+{
+}
+
+LineTree::LineTree(std::shared_ptr<TextArena> arena, const std::vector<std::string_view>& lines)
+    : root(build(lines)), arena(std::move(arena))
+{
+}
+
+LineTree::LineTree(const LineTree& other) : root(other.root), arena(other.arena), owns_arena(false)
+{
+}
+
+LineTree& LineTree::operator=(const LineTree& other)
+{
+    root = other.root;
+    arena = other.arena;
+    owns_arena = false;
+    return *this;
+}
+
+LineTree::NodePtr LineTree::build(const std::vector<std::string_view>& lines)
+{
+    // Pack the lines into full leaves, then build the levels above them bottom up
+    std::vector<NodePtr> nodes;
+    for (size_t i = 0; i < lines.size(); i += MAX_ENTRIES)
+    {
+        auto leaf = std::make_shared<Node>();
+        size_t end = std::min(lines.size(), i + MAX_ENTRIES);
+        leaf->lines.reserve(end - i);
+        for (size_t j = i; j < end; j++)
+        {
+            leaf->lines.push_back(make_line(lines[j]));
+            leaf->bytes += lines[j].size();
+        }
+        leaf->count = leaf->lines.size();
+        update_brackets(*leaf);
+        nodes.push_back(std::move(leaf));
+    }
+
+    if (nodes.empty())
+        return std::make_shared<Node>();
+
+    while (nodes.size() > 1)
+    {
+        std::vector<NodePtr> parents;
+        for (size_t i = 0; i < nodes.size(); i += MAX_ENTRIES)
+        {
+            auto parent = std::make_shared<Node>();
+            size_t end = std::min(nodes.size(), i + MAX_ENTRIES);
+            for (size_t j = i; j < end; j++)
+            {
+                parent->count += nodes[j]->count;
+                parent->bytes += nodes[j]->bytes;
+                parent->children.push_back(std::move(nodes[j]));
+            }
+            update_brackets(*parent);
+            parents.push_back(std::move(parent));
+        }
+        nodes = std::move(parents);
+    }
+    return nodes.front();
+}
+
+size_t LineTree::size() const
+{
+    return root->count;
+}
+
+size_t LineTree::bytes(size_t index) const
+{
+    return line_bytes(entry(index));
+}
+
+std::string LineTree::text(size_t index, size_t from, size_t count) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return std::string(line.text.substr(std::min(from, line.text.size()), count));
+
+    from = std::min(from, line.blocks.size());
+    std::string text(std::min(count, line.blocks.size() - from), '\0');
+    line.blocks.copy(from, text.size(), text.data());
+    return text;
+}
+
+std::string_view LineTree::view(size_t index, TextArena& scratch) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return line.text;
+
+    char* data = scratch.allocate(line.blocks.size());
+    line.blocks.copy(0, line.blocks.size(), data);
+    return std::string_view(data, line.blocks.size());
+}
+
+const LineTree::Line& LineTree::entry(size_t index) const
+{
+    const Node* node = root.get();
+    while (!node->children.empty())
+    {
+        for (const auto& child : node->children)
+        {
+            if (index < child->count)
+            {
+                node = child.get();
+                break;
+            }
+            index -= child->count;
+        }
+    }
+    return node->lines[index];
+}
+
+void LineTree::set(size_t index, std::string_view line)
+{
+    auto previous = own_arena();
+    root = set(root, index, make_line(arena->store(line)));
+    compact_if_wasteful();
+}
+
+void LineTree::splice(size_t index, size_t at, size_t erase, std::string_view text)
+{
+    auto previous = own_arena();
+    const Line& old = entry(index);
+    Line line;
+    if (!old.blocks.empty())
+    {
+        // Only the blocks the edit touches get new text; the rest are shared with the old line
+        line = make_line(old.blocks.edited(*arena, at, erase, text));
+    }
+    else
+    {
+        // Build the new text straight into the arena; the old text stays where it is until compaction
+        at = std::min(at, old.text.size());
+        erase = std::min(erase, old.text.size() - at);
+        size_t size = old.text.size() - erase + text.size();
+        char* data = size > 0 ? arena->allocate(size) : nullptr;
+        char* out = std::copy(old.text.begin(), old.text.begin() + at, data);
+        out = std::copy(text.begin(), text.end(), out);
+        std::copy(old.text.begin() + at + erase, old.text.end(), out);
+        line = make_line(std::string_view(data, size));
+    }
+
+    root = set(root, index, line);
+    compact_if_wasteful();
+}
+
+void LineTree::split(size_t index, size_t at)
+{
+    auto previous = own_arena();
+    const Line& old = entry(index);
+    Line head, tail;
+    if (!old.blocks.empty())
+    {
+        // Both halves share the old blocks, cut where the split falls
+        at = std::min(at, old.blocks.size());
+        tail = make_line(old.blocks.slice(at, old.blocks.size()));
+        head = make_line(old.blocks.slice(0, at));
+    }
+    else
+    {
+        // Both halves are views of the old text
+        at = std::min(at, old.text.size());
+        tail = make_line(old.text.substr(at));
+        head = make_line(old.text.substr(0, at));
+    }
+
+    root = set(root, index, head);
+    insert_line(index + 1, tail);
+    compact_if_wasteful();
+}
+
+void LineTree::join(size_t index)
+{
+    auto previous = own_arena();
+    const Line& first = entry(index);
+    const Line& second = entry(index + 1);
+    Line line;
+    if (!first.blocks.empty() && !second.blocks.empty())
+    {
+        line = make_line(first.blocks.joined(second.blocks));
+    }
+    else if (!first.blocks.empty())
+    {
+        line = make_line(first.blocks.edited(*arena, first.blocks.size(), 0, second.text));
+    }
+    else if (!second.blocks.empty())
+    {
+        line = make_line(second.blocks.edited(*arena, 0, 0, first.text));
+    }
+    else
+    {
+        size_t size = first.text.size() + second.text.size();
+        char* data = size > 0 ? arena->allocate(size) : nullptr;
+        std::copy(second.text.begin(), second.text.end(), std::copy(first.text.begin(), first.text.end(), data));
+        line = make_line(std::string_view(data, size));
+    }
+
+    root = set(root, index, line);
+    erase(index + 1);
+    compact_if_wasteful();
+}
+
+size_t LineTree::length(size_t index) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return BracketBlocks::column_of_byte(line.text, line.text.size());
+    return line.blocks.column_of_byte(line.blocks.size());
+}
+
+size_t LineTree::byte_of_column(size_t index, size_t column) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return BracketBlocks::byte_of_column(line.text, column);
+    return line.blocks.byte_of_column(column);
+}
+
+size_t LineTree::column_of_byte(size_t index, size_t byte) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return BracketBlocks::column_of_byte(line.text, byte);
+    return line.blocks.column_of_byte(byte);
+}
+
+size_t LineTree::scan_bracket_forward(size_t index, size_t from, int64_t& depth) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return brackets::scan_forward(line.text, from, depth);
+    return line.blocks.find_forward(from, depth);
+}
+
+size_t LineTree::scan_bracket_backward(size_t index, size_t to, int64_t& depth) const
+{
+    const Line& line = entry(index);
+    if (line.blocks.empty())
+        return brackets::scan_backward(line.text, std::min(to, line.text.size()), depth);
+    return line.blocks.find_backward(to, depth);
+}
+
+LineTree::Line LineTree::make_line(std::string_view text)
+{
+    Line line;
+    if (text.size() >= LONG_LINE_BYTES)
+    {
+        line.blocks = BracketBlocks(text);
+        line.brackets = line.blocks.summary();
+    }
+    else
+    {
+        line.text = text;
+        line.brackets = brackets::summarize(text);
+    }
+    return line;
+}
+
+// Makes a line of the text held by blocks, putting it back in one piece in the arena if it is no longer long
+LineTree::Line LineTree::make_line(const BracketBlocks& blocks)
+{
+    if (blocks.size() < LONG_LINE_BYTES)
+    {
+        char* data = blocks.size() > 0 ? arena->allocate(blocks.size()) : nullptr;
+        blocks.copy(0, blocks.size(), data);
+        return make_line(std::string_view(data, blocks.size()));
+    }
+
+    Line line;
+    line.blocks = blocks;
+    line.brackets = blocks.summary();
+    return line;
+}
+
+size_t LineTree::line_bytes(const Line& line)
+{
+    return line.blocks.empty() ? line.text.size() : line.blocks.size();
+}
+
+LineTree::NodePtr LineTree::set(const NodePtr& node, size_t index, const Line& line)
+{
+    auto copy = std::make_shared<Node>(*node);
+    if (copy->children.empty())
+    {
+        copy->bytes = copy->bytes - line_bytes(copy->lines[index]) + line_bytes(line);
+        copy->lines[index] = line;
+        update_brackets(*copy);
+        return copy;
+    }
+
+    for (auto& child : copy->children)
+    {
+        if (index < child->count)
+        {
+            copy->bytes -= child->bytes;
+            child = set(child, index, line);
+            copy->bytes += child->bytes;
+            break;
+        }
+        index -= child->count;
+    }
+    update_brackets(*copy);
+    return copy;
+}
+
+void LineTree::insert(size_t index, std::string_view line)
+{
+    auto previous = own_arena();
+    insert_line(index, make_line(arena->store(line)));
+    compact_if_wasteful();
+}
+
+void LineTree::insert_line(size_t index, const Line& line)
+{
+    NodePtr split;
+    NodePtr node = insert(root, index, line, split);
+    if (split)
+    {
+        // The root overflowed, so the tree grows by one level
+        auto new_root = std::make_shared<Node>();
+        new_root->count = node->count + split->count;
+        new_root->bytes = node->bytes + split->bytes;
+        new_root->children = {node, split};
+        update_brackets(*new_root);
+        node = new_root;
+    }
+    root = node;
+}
+
+LineTree::NodePtr LineTree::insert(const NodePtr& node, size_t index, const Line& line, NodePtr& split)
+{
+    auto copy = copy_with_room(*node);
+    copy->count++;
+    copy->bytes += line_bytes(line);
+
+    if (copy->children.empty())
+    {
+        copy->lines.insert(copy->lines.begin() + index, line);
+        if (copy->lines.size() > MAX_ENTRIES)
+        {
+            // Move the upper half into a new sibling
+            auto sibling = std::make_shared<Node>();
+            size_t half = copy->lines.size() / 2;
+            sibling->lines.assign(copy->lines.begin() + half, copy->lines.end());
+            copy->lines.resize(half);
+            sibling->count = sibling->lines.size();
+            for (const auto& moved : sibling->lines)
+                sibling->bytes += line_bytes(moved);
+            copy->count -= sibling->count;
+            copy->bytes -= sibling->bytes;
+            update_brackets(*sibling);
+            split = sibling;
+        }
+        update_brackets(*copy);
+        return copy;
+    }
+
+    // Appending at the end of a child is allowed, so that index == size() lands in the last child
+    size_t k = 0;
+    while (k + 1 < copy->children.size() && index > copy->children[k]->count)
+    {
+        index -= copy->children[k]->count;
+        k++;
+    }
+
+    NodePtr child_split;
+    copy->children[k] = insert(copy->children[k], index, line, child_split);
+    if (child_split)
+        copy->children.insert(copy->children.begin() + k + 1, child_split);
+
+    if (copy->children.size() > MAX_ENTRIES)
+    {
+        auto sibling = std::make_shared<Node>();
+        size_t half = copy->children.size() / 2;
+        sibling->children.assign(copy->children.begin() + half, copy->children.end());
+        copy->children.resize(half);
+        for (const auto& child : sibling->children)
+        {
+            sibling->count += child->count;
+            sibling->bytes += child->bytes;
+        }
+        copy->count -= sibling->count;
+        copy->bytes -= sibling->bytes;
+        update_brackets(*sibling);
+        split = sibling;
+    }
+    update_brackets(*copy);
+    return copy;
+}
+
+void LineTree::erase(size_t index)
+{
+    NodePtr node = erase(root, index);
+    if (!node)
+        node = std::make_shared<Node>();
+
+    // Drop roots left with a single child
+    while (node->children.size() == 1)
+        node = node->children.front();
+    root = node;
+}
+
+LineTree::NodePtr LineTree::erase(const NodePtr& node, size_t index)
+{
+    auto copy = std::make_shared<Node>(*node);
+    copy->count--;
+
+    if (copy->children.empty())
+    {
+        copy->bytes -= line_bytes(copy->lines[index]);
+        copy->lines.erase(copy->lines.begin() + index);
+        update_brackets(*copy);
+        return copy->lines.empty() ? nullptr : copy;
+    }
+
+    for (auto it = copy->children.begin(); it != copy->children.end(); ++it)
+    {
+        if (index < (*it)->count)
+        {
+            // Empty children are removed rather than rebalanced; splits alone keep the tree shallow
+            copy->bytes -= (*it)->bytes;
+            NodePtr child = erase(*it, index);
+            if (child)
+            {
+                copy->bytes += child->bytes;
+                *it = child;
+            }
+            else
+            {
+                copy->children.erase(it);
+            }
+            break;
+        }
+        index -= (*it)->count;
+    }
+    update_brackets(*copy);
+    return copy->children.empty() ? nullptr : copy;
+}
+
+// Copies the text of every line under node to consecutive bytes starting at text, keeping the lines' summaries
+LineTree::NodePtr LineTree::relocate(const NodePtr& node, char*& text)
+{
+    auto copy = std::make_shared<Node>(*node);
+    for (auto& line : copy->lines)
+    {
+        if (!line.blocks.empty())
+        {
+            line.blocks = line.blocks.relocated(text);
+            continue;
+        }
+        size_t size = line.text.size();
+        std::copy(line.text.begin(), line.text.end(), text);
+        line.text = std::string_view(text, size);
+        text += size;
+    }
+    for (auto& child : copy->children)
+        child = relocate(child, text);
+    return copy;
+}
+
+// A copy shares its arena with the tree it was copied from, which may be allocating from it on another thread.
+// Returns the arena given up, if any, so that the caller can keep text it was passed, which may point into it, alive
+// until the edit is done.
+std::shared_ptr<TextArena> LineTree::own_arena()
+{
+    if (owns_arena)
+        return nullptr;
+
+    auto previous = arena;
+    move_to_fresh_arena();
+    return previous;
+}
+
+void LineTree::move_to_fresh_arena()
+{
+    // Other trees using the old arena keep it alive for as long as they need it. Only the text moves: the bracket
+    // summaries are kept as they are, and the blocks of long lines are copied to point at their new text.
+    auto fresh = std::make_shared<TextArena>();
+    char* text = root->bytes > 0 ? fresh->allocate(root->bytes) : nullptr;
+    root = relocate(root, text);
+    arena = std::move(fresh);
+    owns_arena = true;
+}
+
+void LineTree::compact_if_wasteful()
+{
+    if (arena->used() > 2 * root->bytes + COMPACT_SLACK)
+        move_to_fresh_arena();
+}
+
+// Copies node with room for one more entry, so that inserting into the copy doesn't reallocate it straight away
+std::shared_ptr<LineTree::Node> LineTree::copy_with_room(const Node& node)
+{
+    auto copy = std::make_shared<Node>();
+    copy->count = node.count;
+    copy->bytes = node.bytes;
+    copy->brackets = node.brackets;
+    if (node.children.empty())
+    {
+        copy->lines.reserve(node.lines.size() + 1);
+        copy->lines.assign(node.lines.begin(), node.lines.end());
+    }
+    else
+    {
+        copy->children.reserve(node.children.size() + 1);
+        copy->children.assign(node.children.begin(), node.children.end());
+    }
+    return copy;
+}
+
+void LineTree::update_brackets(Node& node)
+{
+    node.brackets = BracketSummary();
+    for (const auto& line : node.lines)
+        node.brackets = brackets::combine(node.brackets, line.brackets);
+    for (const auto& child : node.children)
+        node.brackets = brackets::combine(node.brackets, child->brackets);
+}
+
+size_t LineTree::find_bracket_forward(size_t from, int64_t& depth) const
+{
+    if (from >= root->count)
+        return root->count;
+
+    size_t found = find_bracket_forward(*root, from, depth);
+    return found == std::string_view::npos ? root->count : found;
+}
+
+size_t LineTree::find_bracket_forward(const Node& node, size_t from, int64_t& depth)
+{
+    // Skip whole subtrees in which the depth never drops below zero
+    if (from == 0 && depth + node.brackets.min_prefix >= 0)
+    {
+        depth += node.brackets.delta;
+        return std::string_view::npos;
+    }
+
+    for (size_t i = from; i < node.lines.size(); i++)
+    {
+        if (depth + node.lines[i].brackets.min_prefix < 0)
+            return i;
+        depth += node.lines[i].brackets.delta;
+    }
+
+    size_t start = 0;
+    for (const auto& child : node.children)
+    {
+        if (from < start + child->count)
+        {
+            size_t found = find_bracket_forward(*child, from > start ? from - start : 0, depth);
+            if (found != std::string_view::npos)
+                return start + found;
+        }
+        start += child->count;
+    }
+    return std::string_view::npos;
+}
+
+size_t LineTree::find_bracket_backward(size_t to, int64_t& depth) const
+{
+    size_t found = find_bracket_backward(*root, std::min(to, root->count), depth);
+    return found == std::string_view::npos ? root->count : found;
+}
+
+size_t LineTree::find_bracket_backward(const Node& node, size_t to, int64_t& depth)
+{
+    // Skip whole subtrees in which the count never rises above zero
+    if (to == node.count && depth + node.brackets.max_suffix < 1)
+    {
+        depth += node.brackets.delta;
+        return std::string_view::npos;
+    }
+
+    for (size_t i = std::min(to, node.lines.size()); i-- > 0;)
+    {
+        if (depth + node.lines[i].brackets.max_suffix >= 1)
+            return i;
+        depth += node.lines[i].brackets.delta;
+    }
+
+    size_t end = node.count;
+    for (auto child = node.children.rbegin(); child != node.children.rend(); ++child)
+    {
+        size_t start = end - (*child)->count;
+        if (to > start)
+        {
+            size_t found = find_bracket_backward(**child, std::min(to - start, (*child)->count), depth);
+            if (found != std::string_view::npos)
+                return start + found;
+        }
+        end = start;
+    }
+    return std::string_view::npos;
+}
@@ -0,0 +1,125 @@
+#ifndef LINE_TREE_H
+#define LINE_TREE_H
+
+#include "brackets.h"
+#include "text_arena.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Persistent sequence of lines stored in a B-tree. Nodes are immutable once built: an edit copies only the path
+// from the root to the changed leaf and shares every other node with the previous version. Copying a LineTree is
+// therefore O(1), and a copy handed to another thread stays valid and unchanged while the original is edited.
+//
+// Line text lives in a TextArena shared by all copies of the tree, so loading a file costs one allocation per leaf
+// rather than one per line. Only the tree that owns the arena allocates from it: a copy moves its text to an arena of
+// its own before its first edit, so editing a copy on one thread never races with editing the original on another.
+//
+// Every node also carries the bracket summary of its lines, so the line holding a matching bracket can be found by
+// descending the tree rather than scanning the text in between. Long lines are held as BracketBlocks rather than in
+// one piece, which does the same within the line, converts between columns and byte offsets, and lets an edit write
+// only the blocks it touches instead of the whole line.
+class LineTree
+{
+    struct Line
+    {
+        std::string_view text; // short lines only
+        BracketSummary brackets;
+        BracketBlocks blocks; // long lines only
+    };
+
+    struct Node
+    {
+        size_t count = 0;                                  // number of lines in this subtree
+        size_t bytes = 0;                                  // number of text bytes in this subtree
+        BracketSummary brackets;                           // bracket summary of this subtree
+        std::vector<Line> lines;                           // leaf nodes only
+        std::vector<std::shared_ptr<const Node>> children; // internal nodes only
+    };
+    using NodePtr = std::shared_ptr<const Node>;
+
+    NodePtr root;
+    std::shared_ptr<TextArena> arena;
+    bool owns_arena = true; // false for copies, which share the arena of the tree they were copied from
+
+  public:
+    LineTree();
+
+    // Builds a tree over lines which already point into arena, and takes over allocating from it.
+    LineTree(std::shared_ptr<TextArena> arena, const std::vector<std::string_view>& lines);
+
+    LineTree(const LineTree& other);
+    LineTree& operator=(const LineTree& other);
+    LineTree(LineTree&& other) = default;
+    LineTree& operator=(LineTree&& other) = default;
+
+    size_t size() const;
+
+    // Number of bytes in line index.
+    size_t bytes(size_t index) const;
+
+    // Returns a copy of count bytes of line index starting at byte from.
+    std::string text(size_t index, size_t from = 0, size_t count = std::string_view::npos) const;
+
+    // Returns the text of line index, copying it to scratch if it is long and so not held in one piece.
+    std::string_view view(size_t index, TextArena& scratch) const;
+
+    void set(size_t index, std::string_view line);
+
+    // Inserts line so that it ends up at index; index may equal size().
+    void insert(size_t index, std::string_view line);
+    void erase(size_t index);
+
+    // Replaces erase bytes of line index, starting at byte at, with text. Unlike set, this only writes the blocks of
+    // a long line around the edit.
+    void splice(size_t index, size_t at, size_t erase, std::string_view text);
+
+    // Splits line index at byte at, moving the rest of it to a new line after it.
+    void split(size_t index, size_t at);
+
+    // Appends line index + 1 to line index and removes it.
+    void join(size_t index);
+
+    // Number of characters in line index.
+    size_t length(size_t index) const;
+
+    // Returns the byte offset of the character at column of line index, or the line's size if it is shorter.
+    size_t byte_of_column(size_t index, size_t column) const;
+
+    // Returns the number of characters of line index which start before byte.
+    size_t column_of_byte(size_t index, size_t byte) const;
+
+    // Returns the first line at or after from in which the bracket depth, starting at depth, drops below zero, or
+    // size() if there is none. depth is advanced past the lines skipped.
+    size_t find_bracket_forward(size_t from, int64_t& depth) const;
+
+    // Returns the last line before to in which the count of opening minus closing brackets, scanning backwards from
+    // depth, rises above zero, or size() if there is none. depth is advanced past the lines skipped.
+    size_t find_bracket_backward(size_t to, int64_t& depth) const;
+
+    // Same as brackets::scan_forward and brackets::scan_backward over the text of line index.
+    size_t scan_bracket_forward(size_t index, size_t from, int64_t& depth) const;
+    size_t scan_bracket_backward(size_t index, size_t to, int64_t& depth) const;
+
+  private:
+    static Line make_line(std::string_view text);
+    Line make_line(const BracketBlocks& blocks);
+    static size_t line_bytes(const Line& line);
+    static NodePtr build(const std::vector<std::string_view>& lines);
+    static NodePtr set(const NodePtr& node, size_t index, const Line& line);
+    static NodePtr insert(const NodePtr& node, size_t index, const Line& line, NodePtr& split);
+    static NodePtr erase(const NodePtr& node, size_t index);
+    void insert_line(size_t index, const Line& line);
+    static NodePtr relocate(const NodePtr& node, char*& text);
+    static std::shared_ptr<Node> copy_with_room(const Node& node);
+    static void update_brackets(Node& node);
+    static size_t find_bracket_forward(const Node& node, size_t from, int64_t& depth);
+    static size_t find_bracket_backward(const Node& node, size_t to, int64_t& depth);
+    const Line& entry(size_t index) const;
+    std::shared_ptr<TextArena> own_arena();
+    void move_to_fresh_arena();
+    void compact_if_wasteful();
+};
+
+#endif
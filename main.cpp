@@ -1,8 +1,8 @@
 #include "editor.h"
 
-int main()
+int main(int argc, char* argv[])
 {
-    Editor editor;
+    Editor editor(argc > 1 ? argv[1] : "../document.cpp");
     editor.init();
     editor.run();
     return 0;
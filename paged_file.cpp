@@ -0,0 +1,296 @@
+#include "paged_file.h"
+#include "index_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PagedFile::PagedFile(const std::string& filename, size_t max_resident_bytes)
+    : filename(filename), file_size(0), max_pages(std::max<size_t>(1, max_resident_bytes / PAGE_BYTES))
+{
+    checkpoints.push_back(0);
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        file_size = st.st_size;
+        mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    if (load_cached_index())
+    {
+        scan_start = file_size;
+    }
+    else
+    {
+        scan_start = indexed_bytes;
+        indexer = std::thread(&PagedFile::build_index, this, indexed_bytes, indexed_lines);
+    }
+}
+
+PagedFile::~PagedFile()
+{
+    stop_indexing = true;
+    if (indexer.joinable())
+        indexer.join();
+    if (fd >= 0)
+        close(fd);
+}
+
+bool PagedFile::is_open() const
+{
+    return fd >= 0;
+}
+
+uint64_t PagedFile::size() const
+{
+    return file_size;
+}
+
+const std::string& PagedFile::page(uint64_t index)
+{
+    auto it = pages.find(index);
+    if (it != pages.end())
+    {
+        // Mark the page as most recently used
+        lru.splice(lru.begin(), lru, it->second.lru_entry);
+        return it->second.data;
+    }
+
+    // Evict the least recently used page to stay within the memory cap
+    if (pages.size() >= max_pages)
+    {
+        pages.erase(lru.back());
+        lru.pop_back();
+    }
+
+    Page& page = pages[index];
+    uint64_t start = index * PAGE_BYTES;
+    size_t len = start < file_size ? std::min<uint64_t>(PAGE_BYTES, file_size - start) : 0;
+    page.data.resize(len);
+
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pread(fd, &page.data[done], len - done, start + done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    page.data.resize(done);
+
+    lru.push_front(index);
+    page.lru_entry = lru.begin();
+    return page.data;
+}
+
+std::string PagedFile::read_line(uint64_t offset, size_t max_bytes)
+{
+    std::string line;
+    while (offset < file_size && line.size() < max_bytes)
+    {
+        const std::string& data = page(offset / PAGE_BYTES);
+        size_t pos = offset % PAGE_BYTES;
+        if (pos >= data.size())
+            break;
+
+        const char* begin = data.data() + pos;
+        size_t avail = std::min(data.size() - pos, max_bytes - line.size());
+        auto newline = static_cast<const char*>(memchr(begin, '\n', avail));
+        if (newline)
+        {
+            line.append(begin, newline - begin);
+            break;
+        }
+        line.append(begin, avail);
+        offset += avail;
+    }
+    return line;
+}
+
+uint64_t PagedFile::line_start(uint64_t offset)
+{
+    offset = std::min(offset, file_size);
+    while (offset > 0)
+    {
+        uint64_t index = (offset - 1) / PAGE_BYTES;
+        const std::string& data = page(index);
+        size_t end = std::min<size_t>(offset - index * PAGE_BYTES, data.size());
+        auto newline = static_cast<const char*>(memrchr(data.data(), '\n', end));
+        if (newline)
+            return index * PAGE_BYTES + (newline - data.data()) + 1;
+        offset = index * PAGE_BYTES;
+    }
+    return 0;
+}
+
+uint64_t PagedFile::next_line(uint64_t offset)
+{
+    while (offset < file_size)
+    {
+        const std::string& data = page(offset / PAGE_BYTES);
+        size_t pos = offset % PAGE_BYTES;
+        if (pos >= data.size())
+            break;
+
+        auto newline = static_cast<const char*>(memchr(data.data() + pos, '\n', data.size() - pos));
+        if (newline)
+            return std::min(file_size, offset + (newline - (data.data() + pos)) + 1);
+        offset += data.size() - pos;
+    }
+    return file_size;
+}
+
+uint64_t PagedFile::prev_line(uint64_t offset)
+{
+    uint64_t start = line_start(offset);
+    return start == 0 ? 0 : line_start(start - 1);
+}
+
+uint64_t PagedFile::offset_of_percent(int percent)
+{
+    if (file_size == 0)
+        return 0;
+
+    percent = std::clamp(percent, 0, 100);
+    uint64_t target = file_size / 100 * percent + file_size % 100 * percent / 100;
+    return line_start(std::min(target, file_size - 1));
+}
+
+uint64_t PagedFile::offset_of_line(uint64_t line)
+{
+    uint64_t start;
+    uint64_t remaining;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        uint64_t checkpoint = line / LINES_PER_CHECKPOINT;
+        if (checkpoint < checkpoints.size() || index_complete)
+        {
+            // Walk forward from the nearest checkpoint; past the end of the file this stops at the last line
+            checkpoint = std::min<uint64_t>(checkpoint, checkpoints.size() - 1);
+            start = checkpoints[checkpoint];
+            remaining = line - checkpoint * LINES_PER_CHECKPOINT;
+        }
+        else
+        {
+            // The indexer hasn't got this far yet, so guess from the average line length seen so far
+            double bytes_per_line = indexed_lines > 0 ? (double)indexed_bytes / indexed_lines : 80.0;
+            double estimate = std::min<double>((double)line * bytes_per_line, (double)file_size);
+            start = (uint64_t)estimate;
+            remaining = 0;
+        }
+    }
+
+    start = line_start(start);
+    while (remaining-- > 0)
+    {
+        uint64_t next = next_line(start);
+        if (next >= file_size)
+            break;
+        start = next;
+    }
+    return start;
+}
+
+size_t PagedFile::resident_pages() const
+{
+    return pages.size();
+}
+
+bool PagedFile::indexed() const
+{
+    std::lock_guard<std::mutex> lock(index_mutex);
+    return index_complete;
+}
+
+uint64_t PagedFile::index_scan_start() const
+{
+    return scan_start;
+}
+
+bool PagedFile::load_cached_index()
+{
+    IndexCacheEntry cached;
+    if (!index_cache::load(filename, file_size, cached))
+        return false;
+
+    // The file must still start and, up to the cached size, end with the same bytes
+    IndexCacheEntry current;
+    current.file_size = cached.file_size;
+    index_cache::hash_file(fd, current);
+    if (current.head_hash != cached.head_hash || current.tail_hash != cached.tail_hash)
+        return false;
+
+    // Same size but modified: the change could be anywhere, so start over
+    bool complete = cached.file_size == file_size;
+    if (complete && cached.mtime_ns != mtime_ns)
+        return false;
+
+    // A line starting exactly at the old end of the file wasn't a line then, so it has no checkpoint yet
+    if (!complete && cached.lines > 0 && cached.lines % LINES_PER_CHECKPOINT == 0 &&
+        cached.checkpoints.size() == cached.lines / LINES_PER_CHECKPOINT)
+        cached.checkpoints.push_back(cached.file_size);
+
+    std::lock_guard<std::mutex> lock(index_mutex);
+    checkpoints = std::move(cached.checkpoints);
+    indexed_bytes = cached.file_size;
+    indexed_lines = cached.lines;
+    index_complete = complete;
+    return complete;
+}
+
+void PagedFile::build_index(uint64_t offset, uint64_t lines)
+{
+    // The indexer streams the file through its own small buffer so that it neither touches nor grows the page cache
+    std::ifstream file(filename, std::ios::binary);
+    file.seekg(offset);
+    std::vector<char> buffer(1 << 20);
+    std::vector<uint64_t> found;
+
+    // Stop at the size seen on opening; lines appended since then belong to the next open, which resumes from here
+    while (!stop_indexing && file && offset < file_size)
+    {
+        file.read(buffer.data(), std::min<uint64_t>(buffer.size(), file_size - offset));
+        size_t n = file.gcount();
+        if (n == 0)
+            break;
+
+        found.clear();
+        const char* begin = buffer.data();
+        const char* end = begin + n;
+        for (const char* p = begin; (p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr; p++)
+        {
+            lines++;
+            uint64_t next = offset + (p - begin) + 1;
+            if (lines % LINES_PER_CHECKPOINT == 0 && next < file_size)
+                found.push_back(next);
+        }
+        offset += n;
+
+        std::lock_guard<std::mutex> lock(index_mutex);
+        checkpoints.insert(checkpoints.end(), found.begin(), found.end());
+        indexed_bytes = offset;
+        indexed_lines = lines;
+    }
+
+    IndexCacheEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        index_complete = !stop_indexing && offset >= file_size;
+        if (!index_complete)
+            return;
+
+        entry.checkpoints = checkpoints;
+    }
+
+    entry.file_size = file_size;
+    entry.mtime_ns = mtime_ns;
+    entry.lines = lines;
+    index_cache::hash_file(fd, entry);
+    index_cache::store(filename, entry);
+}
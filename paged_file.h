@@ -0,0 +1,92 @@
+#ifndef PAGED_FILE_H
+#define PAGED_FILE_H
+
+#include "index_cache.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Read-only view of a file which keeps at most a fixed number of pages in memory. Pages are read on demand and
+// evicted least recently used first. A sparse index of line start offsets is built in the background so that a line
+// number can be mapped to a byte offset without scanning the whole file. The finished index is saved to the index
+// cache, so reopening the file reuses it, and only the new tail is scanned if the file has grown.
+class PagedFile
+{
+    struct Page
+    {
+        std::string data;
+        std::list<uint64_t>::iterator lru_entry;
+    };
+
+    std::string filename;
+    int fd;
+    uint64_t file_size;
+    int64_t mtime_ns = 0;
+    size_t max_pages;
+    std::unordered_map<uint64_t, Page> pages;
+    std::list<uint64_t> lru;
+
+    // Byte offset of every LINES_PER_CHECKPOINT'th line, starting with line 0. Written by the indexer thread.
+    std::vector<uint64_t> checkpoints;
+    uint64_t indexed_bytes = 0;
+    uint64_t indexed_lines = 0;
+    uint64_t scan_start = 0;
+    bool index_complete = false;
+    mutable std::mutex index_mutex;
+    std::atomic<bool> stop_indexing{false};
+    std::thread indexer;
+
+  public:
+    static constexpr size_t PAGE_BYTES = 64 * 1024;
+    static constexpr uint64_t LINES_PER_CHECKPOINT = index_cache::LINES_PER_CHECKPOINT;
+
+    PagedFile(const std::string& filename, size_t max_resident_bytes);
+    ~PagedFile();
+    PagedFile(const PagedFile&) = delete;
+    PagedFile& operator=(const PagedFile&) = delete;
+
+    bool is_open() const;
+    uint64_t size() const;
+
+    // Returns the bytes of the line starting at offset, without the newline and truncated to max_bytes.
+    std::string read_line(uint64_t offset, size_t max_bytes);
+
+    // Returns the offset of the start of the line containing offset.
+    uint64_t line_start(uint64_t offset);
+
+    // Returns the offset of the line following the one starting at offset, or size() if it is the last line.
+    uint64_t next_line(uint64_t offset);
+
+    // Returns the offset of the line preceding the one starting at offset, or 0 if it is the first line.
+    uint64_t prev_line(uint64_t offset);
+
+    // Returns the start of the line containing the byte at the given percentage of the file.
+    uint64_t offset_of_percent(int percent);
+
+    // Returns the start of the given zero-based line. Exact once the index has reached the line, otherwise
+    // estimated from the average line length seen so far.
+    uint64_t offset_of_line(uint64_t line);
+
+    // Number of pages held in memory, which never exceeds the cap given to the constructor.
+    size_t resident_pages() const;
+
+    // True once the line index covers the whole file.
+    bool indexed() const;
+
+    // Offset from which the file was scanned for the line index when it was opened: 0 for a full scan, the old size
+    // when a cached index of a shorter version of the file was extended, or size() when the cached index was current.
+    uint64_t index_scan_start() const;
+
+  private:
+    // The returned reference is only valid until the next call, which may evict the page.
+    const std::string& page(uint64_t index);
+    bool load_cached_index();
+    void build_index(uint64_t offset, uint64_t lines);
+};
+
+#endif
@@ -1,3 +1,47 @@
+#include "background.h"
+#include "document.h"
+#include "paged_file.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <ncurses.h>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counts heap allocations so that the benchmarks can report them
+static std::atomic<size_t> allocation_count{0};
+
+void* operator new(size_t size)
+{
+    allocation_count++;
+    if (void* p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static int failures = 0;
+
 void assertEqual(std::string expected, std::string actual, std::string message)
 {
     if (expected == actual)
@@ -7,6 +51,7 @@ void assertEqual(std::string expected, std::string actual, std::string message)
     else
     {
         std::cout << message << ": Test Failed. Expected '" << expected << "', but got '" << actual << "'\n";
+        failures++;
     }
 }
 
@@ -19,9 +64,15 @@ void assertEqual(int expected, int actual, std::string message)
     else
     {
         std::cout << message << ": Test Failed. Expected '" << expected << "', but got '" << actual << "'\n";
+        failures++;
     }
 }
 
+std::string currentLine(const Document& doc)
+{
+    return doc.snapshot().lines.text(doc.cursor_line());
+}
+
 void testInsert()
 {
     Document doc;
@@ -38,7 +89,7 @@ void testInsert()
     doc.insert('l');
     doc.insert('d');
     doc.insert('!');
-    assertEqual("Hello, world!", doc.getCurrentLine(), "Insert test");
+    assertEqual("Hello, world!", currentLine(doc), "Insert test");
 }
 
 void testNewlineInsert()
@@ -47,15 +98,15 @@ void testNewlineInsert()
     doc.insert('H');
     doc.insert('\n');
     doc.insert('H');
-    assertEqual("H", doc.getCurrentLine(), "Newline insert test");
+    assertEqual("H", currentLine(doc), "Newline insert test");
 }
 
 void testCursorLeft()
 {
     Document doc;
     doc.insert('H');
-    doc.cursorLeft();
-    assertEqual("H", doc.getCurrentLine(), "Cursor left test");
+    doc.cursor_left();
+    assertEqual("H", currentLine(doc), "Cursor left test");
 }
 
 void testCursorHome()
@@ -63,22 +114,22 @@ void testCursorHome()
     Document doc;
     doc.insert('H');
     doc.cursor_home();
-    assertEqual("H", doc.getCurrentLine(), "Cursor home test");
+    assertEqual("H", currentLine(doc), "Cursor home test");
 }
 
 void testCursorEnd()
 {
     Document doc;
     doc.insert('H');
-    doc.cursorEnd();
-    assertEqual("H", doc.getCurrentLine(), "Cursor end test");
+    doc.cursor_end();
+    assertEqual("H", currentLine(doc), "Cursor end test");
 }
 
 void testDeleteForwardEmptyDocument()
 {
     Document doc;
     doc.delete_forward();
-    assertEqual("", doc.getCurrentLine(), "Delete forward on an empty Document test");
+    assertEqual("", currentLine(doc), "Delete forward on an empty Document test");
 }
 
 void testDeleteForwardEndOfDocumentMultipleCharacters()
@@ -87,7 +138,7 @@ void testDeleteForwardEndOfDocumentMultipleCharacters()
     doc.insert('H');
     doc.insert('i');
     doc.delete_forward();
-    assertEqual("Hi", doc.getCurrentLine(), "Delete forward at end of Document with multiple characters test");
+    assertEqual("Hi", currentLine(doc), "Delete forward at end of Document with multiple characters test");
 }
 
 void testDeleteForwardEndOfLineNotEndOfDocument()
@@ -100,15 +151,15 @@ void testDeleteForwardEndOfLineNotEndOfDocument()
     doc.insert('B');
     doc.insert('y');
     doc.insert('e');
-    doc.cursorUp();
-    doc.cursorHome();
+    doc.cursor_up();
+    doc.cursor_home();
     doc.cursor_right();
     doc.cursor_right();
     doc.delete_forward();
 
-    assertEqual("HiBye", doc.getCurrentLine(), "Delete forward end of line not end of Document test");
-    assertEqual(0, doc.getCursorLine(), "Delete forward end of line not end of Document test");
-    assertEqual(2, doc.getCursorCol(), "Delete forward end of line not end of Document test");
+    assertEqual("HiBye", currentLine(doc), "Delete forward end of line not end of Document test");
+    assertEqual(0, (int)doc.cursor_line(), "Delete forward end of line not end of Document test");
+    assertEqual(2, (int)doc.cursor_column(), "Delete forward end of line not end of Document test");
 }
 
 void testDeleteForwardMiddleOfLine()
@@ -118,10 +169,10 @@ void testDeleteForwardMiddleOfLine()
     doc.insert('B');
     doc.insert('C');
     doc.insert('D');
-    doc.cursorLeft();
-    doc.cursorLeft();
-    doc.deleteForward();
-    assertEqual("ABD", doc.getCurrentLine(), "Delete forward in middle of line test");
+    doc.cursor_left();
+    doc.cursor_left();
+    doc.delete_forward();
+    assertEqual("ABD", currentLine(doc), "Delete forward in middle of line test");
 }
 
 void testCursorRight()
@@ -129,9 +180,9 @@ void testCursorRight()
     Document doc;
     doc.insert('A');
     doc.insert('B');
-    doc.insert('B');
+    doc.insert('C');
     doc.cursor_right();
-    assertEqual("ABC", doc.getCurrentLine(), "Cursor right test");
+    assertEqual("ABC", currentLine(doc), "Cursor right test");
 }
 
 void testCursorRightEndOfDocument()
@@ -141,7 +192,7 @@ void testCursorRightEndOfDocument()
     doc.insert('B');
     doc.insert('C');
     doc.cursor_right();
-    assertEqual("ABC", doc.getCurrentLine(), "Cursor right at end of Document test");
+    assertEqual("ABC", currentLine(doc), "Cursor right at end of Document test");
 }
 
 void testCursorRightEndOfLine()
@@ -154,13 +205,1144 @@ void testCursorRightEndOfLine()
     doc.insert('D');
     doc.insert('E');
     doc.insert('F');
-    doc.cursorLeft();
-    doc.cursorLeft();
-    doc.cursorLeft();
-    doc.cursorLeft();
-    assertEqual(0, doc.getCursorLine(), "Cursor right at end of line test");
-    doc.cursorRight();
-    assertEqual("DEF", doc.getCurrentLine(), "Cursor right at end of line test");
+    doc.cursor_left();
+    doc.cursor_left();
+    doc.cursor_left();
+    doc.cursor_left();
+    assertEqual(0, (int)doc.cursor_line(), "Cursor right at end of line test");
+    doc.cursor_right();
+    assertEqual("DEF", currentLine(doc), "Cursor right at end of line test");
+}
+
+void testJumpToPercent()
+{
+    Document doc;
+    for (int i = 0; i < 100; i++)
+        doc.insert('\n');
+    doc.jump_to_percent(100);
+    assertEqual(100, (int)doc.cursor_line(), "Jump to percent test");
+    doc.jump_to_percent(37);
+    assertEqual(37, (int)doc.cursor_line(), "Jump to percent test");
+    doc.jump_to_percent(0);
+    assertEqual(0, (int)doc.cursor_line(), "Jump to percent test");
+}
+
+// Sums the bytes of every line in a snapshot, weighted by line number so that moved text changes the result.
+int snapshotChecksum(const DocumentSnapshot& snapshot)
+{
+    int sum = 0;
+    for (size_t i = 0; i < snapshot.lines.size(); i++)
+    {
+        for (char ch : snapshot.lines.text(i))
+            sum += (int)(i + 1) * ch;
+    }
+    return sum;
+}
+
+// Configure with -DTE_TSAN=ON to check that readers never race with the writer.
+void testSnapshotConcurrentReaders()
+{
+    Document doc;
+    std::mutex published_mutex;
+    DocumentSnapshot published = doc.snapshot();
+    int published_checksum = snapshotChecksum(published);
+    bool done = false;
+    int mismatches = 0;
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; r++)
+    {
+        readers.emplace_back([&] {
+            while (true)
+            {
+                DocumentSnapshot snapshot;
+                int expected;
+                {
+                    std::lock_guard<std::mutex> lock(published_mutex);
+                    if (done)
+                        return;
+                    snapshot = published;
+                    expected = published_checksum;
+                }
+
+                // Scan without holding the lock while the writer keeps editing
+                if (snapshotChecksum(snapshot) != expected)
+                {
+                    std::lock_guard<std::mutex> lock(published_mutex);
+                    mismatches++;
+                }
+            }
+        });
+    }
+
+    std::mt19937 random(42);
+    for (int i = 0; i < 5000; i++)
+    {
+        switch (random() % 8)
+        {
+        case 0:
+            doc.insert('\n');
+            break;
+        case 1:
+            doc.delete_backward();
+            break;
+        case 2:
+            doc.delete_forward();
+            break;
+        case 3:
+            doc.cursor_up();
+            break;
+        case 4:
+            doc.cursor_down();
+            break;
+        default:
+            doc.insert('a' + random() % 26);
+            break;
+        }
+
+        DocumentSnapshot snapshot = doc.snapshot();
+        int checksum = snapshotChecksum(snapshot);
+        std::lock_guard<std::mutex> lock(published_mutex);
+        published = snapshot;
+        published_checksum = checksum;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(published_mutex);
+        done = true;
+    }
+    for (auto& reader : readers)
+        reader.join();
+
+    assertEqual(0, mismatches, "Snapshot concurrent readers test");
+}
+
+// Edits a snapshot on another thread while the document is edited, then checks that neither saw the other's edits.
+// Configure with -DTE_TSAN=ON to check that the two never allocate from the same arena.
+void testSnapshotEditedOnWorker()
+{
+    Document doc;
+    for (int i = 0; i < 100; i++)
+        doc.insert(i % 10 == 9 ? '\n' : 'a');
+    DocumentSnapshot snapshot = doc.snapshot();
+    std::string before = snapshot.lines.text(0);
+
+    std::thread worker([&] {
+        for (int i = 0; i < 5000; i++)
+        {
+            snapshot.lines.splice(0, 0, 0, "w");
+            snapshot.lines.insert(1, "worker");
+        }
+    });
+    for (int i = 0; i < 5000; i++)
+        doc.insert(i % 10 == 9 ? '\n' : 'd');
+    worker.join();
+
+    DocumentSnapshot after = doc.snapshot();
+    bool document_clean = true;
+    for (size_t i = 0; i < after.lines.size(); i++)
+    {
+        if (after.lines.text(i).find('w') != std::string::npos)
+            document_clean = false;
+    }
+    assertEqual(std::string(5000, 'w') + before, snapshot.lines.text(0), "Snapshot edited on worker test");
+    assertEqual(1, document_clean, "Snapshot edited on worker test");
+
+    // The first edit of a copy whose original is gone may be given text from the arena the copy is leaving
+    LineTree copy;
+    {
+        LineTree original;
+        original.insert(0, "abc");
+        original.insert(1, "def");
+        copy = original;
+    }
+    TextArena scratch;
+    copy.splice(0, 3, 0, copy.view(1, scratch));
+    assertEqual("abcdef", copy.text(0), "Copy edited with its own text test");
+}
+
+void writeText(const char* filename, const std::vector<std::string>& lines)
+{
+    std::ofstream file(filename, std::ios::binary);
+    for (const auto& line : lines)
+        file << line << '\n';
+}
+
+// Characters are counted as the bytes which don't continue a UTF-8 sequence, as the editor does.
+size_t columnOfByte(std::string_view text, size_t byte)
+{
+    size_t column = 0;
+    for (size_t i = 0; i < byte && i < text.size(); i++)
+    {
+        if (((unsigned char)text[i] & 0xC0) != 0x80)
+            column++;
+    }
+    return column;
+}
+
+size_t byteOfColumn(std::string_view text, size_t column)
+{
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (((unsigned char)text[i] & 0xC0) != 0x80 && column-- == 0)
+            return i;
+    }
+    return text.size();
+}
+
+// Random text in which about one piece in every sparseness is a bracket, so that brackets nest across many lines.
+std::string randomText(std::mt19937& random, size_t length, int sparseness)
+{
+    const char* brackets = "{[()]}";
+    const char* others[] = {"a", "\xC3\xA9", " "};
+    std::string text;
+    while (text.size() < length)
+    {
+        if ((int)(random() % sparseness) == 0)
+            text += brackets[random() % 6];
+        else
+            text += others[random() % 3];
+    }
+    return text;
+}
+
+// Checks the blocks of a long line, updated by edits rather than built, against plain scans from every bracket and
+// against counting characters
+void testBracketBlocksMatchScan()
+{
+    const char* pieces[] = {"{", "[", "(", ")", "]", "}", "a", "\xC3\xA9", ": ", " "};
+    std::string json;
+    std::mt19937 random(7);
+    while (json.size() < 50000)
+        json += pieces[random() % 10];
+
+    const std::string original = json;
+    TextArena arena;
+    BracketBlocks blocks(original);
+    for (int i = 0; i < 200; i++)
+    {
+        size_t at = random() % json.size();
+        if (i % 2 == 0)
+        {
+            std::string piece = pieces[random() % 10];
+            json.insert(at, piece);
+            blocks = blocks.edited(arena, at, 0, piece);
+        }
+        else
+        {
+            json.erase(at, 1);
+            blocks = blocks.edited(arena, at, 1, {});
+        }
+    }
+
+    // Each edit writes new text only for the few blocks around it
+    std::string text(blocks.size(), '\0');
+    blocks.copy(0, text.size(), text.data());
+    assertEqual(json, text, "Bracket blocks text test");
+    assertEqual(1, arena.used() <= 200 * 3 * BracketBlocks::BLOCK_BYTES, "Bracket blocks edit cost test");
+
+    int mismatches = 0;
+    for (size_t i = 0; i < json.size(); i++)
+    {
+        int64_t indexed_depth = 0;
+        int64_t scanned_depth = 0;
+        int change = brackets::depth_change(json[i]);
+        if (change > 0 &&
+            blocks.find_forward(i + 1, indexed_depth) != brackets::scan_forward(json, i + 1, scanned_depth))
+            mismatches++;
+        if (change < 0 && blocks.find_backward(i, indexed_depth) != brackets::scan_backward(json, i, scanned_depth))
+            mismatches++;
+        if (indexed_depth != scanned_depth)
+            mismatches++;
+    }
+    assertEqual(0, mismatches, "Bracket blocks match scan test");
+
+    mismatches = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        size_t byte = random() % (json.size() + 1);
+        size_t column = columnOfByte(json, byte);
+        if (blocks.column_of_byte(byte) != column)
+            mismatches++;
+        if (blocks.byte_of_column(column) != byteOfColumn(json, column))
+            mismatches++;
+    }
+    if (blocks.byte_of_column(json.size()) != json.size())
+        mismatches++;
+    assertEqual(0, mismatches, "Bracket blocks columns test");
+
+    // Cutting the line in two and joining the halves again gives back the same text and summary
+    size_t middle = json.size() / 3;
+    BracketBlocks rejoined = blocks.slice(0, middle).joined(blocks.slice(middle, json.size()));
+    std::string rejoined_text(rejoined.size(), '\0');
+    rejoined.copy(0, rejoined_text.size(), rejoined_text.data());
+    assertEqual(json, rejoined_text, "Bracket blocks slice test");
+    assertEqual(1, rejoined.summary().delta == blocks.summary().delta &&
+                       rejoined.summary().min_prefix == blocks.summary().min_prefix &&
+                       rejoined.summary().max_suffix == blocks.summary().max_suffix,
+                "Bracket blocks slice test");
+}
+
+// Edits, splits and joins lines around the length at which they start being held as blocks, and checks their text
+// and lengths against plain strings
+void testLongLineEdits()
+{
+    const size_t LONG = 64 * 1024;
+    std::mt19937 random(11);
+    std::vector<std::string> lines = {randomText(random, LONG + 10, 8), randomText(random, LONG - 10, 8)};
+    LineTree tree;
+    tree.insert(0, lines[0]);
+    tree.insert(1, lines[1]);
+
+    int mismatches = 0;
+    for (int i = 0; i < 300; i++)
+    {
+        size_t index = random() % lines.size();
+        switch (random() % 4)
+        {
+        case 0:
+        {
+            size_t at = random() % (lines[index].size() + 1);
+            lines.insert(lines.begin() + index + 1, lines[index].substr(at));
+            lines[index].erase(at);
+            tree.split(index, at);
+            break;
+        }
+        case 1:
+            if (index + 1 < lines.size())
+            {
+                lines[index] += lines[index + 1];
+                lines.erase(lines.begin() + index + 1);
+                tree.join(index);
+            }
+            break;
+        default:
+        {
+            std::string text = randomText(random, random() % 40, 4);
+            size_t at = random() % (lines[index].size() + 1);
+            size_t erase = random() % 50;
+            lines[index].replace(at, erase, text);
+            tree.splice(index, at, erase, text);
+            break;
+        }
+        }
+
+        // Keep the lines near the threshold
+        if (lines.size() > 4)
+        {
+            lines[0] += lines[1];
+            lines.erase(lines.begin() + 1);
+            tree.join(0);
+        }
+    }
+
+    if (tree.size() != lines.size())
+        mismatches++;
+    for (size_t i = 0; i < lines.size() && i < tree.size(); i++)
+    {
+        if (tree.text(i) != lines[i] || tree.bytes(i) != lines[i].size())
+            mismatches++;
+        if (tree.length(i) != columnOfByte(lines[i], lines[i].size()))
+            mismatches++;
+        size_t from = random() % (lines[i].size() + 1);
+        if (tree.text(i, from, 100) != lines[i].substr(from, 100))
+            mismatches++;
+    }
+    assertEqual(0, mismatches, "Long line edits test");
+}
+
+// Checks the line tree's search for the line holding a bracket, which skips whole subtrees by their summaries,
+// against stepping through the lines one by one, after edits of every kind
+void testLineTreeBracketSearch()
+{
+    std::mt19937 random(9);
+    auto arena = std::make_shared<TextArena>();
+    std::vector<std::string> lines;
+    std::vector<std::string_view> views;
+    for (int i = 0; i < 5000; i++)
+        lines.push_back(randomText(random, i == 2500 ? 70000 : random() % 40, 12));
+    for (const auto& line : lines)
+        views.push_back(arena->store(line));
+    LineTree tree(arena, views);
+
+    for (int i = 0; i < 500; i++)
+    {
+        size_t index = random() % lines.size();
+        switch (random() % 4)
+        {
+        case 0:
+            lines.insert(lines.begin() + index, randomText(random, random() % 40, 4));
+            tree.insert(index, lines[index]);
+            break;
+        case 1:
+            lines.erase(lines.begin() + index);
+            tree.erase(index);
+            break;
+        case 2:
+            lines[index] = randomText(random, random() % 40, 4);
+            tree.set(index, lines[index]);
+            break;
+        default:
+        {
+            std::string text = randomText(random, random() % 4, 2);
+            size_t at = random() % (lines[index].size() + 1);
+            size_t erase = random() % 3;
+            lines[index].replace(at, erase, text);
+            tree.splice(index, at, erase, text);
+            break;
+        }
+        }
+    }
+
+    std::vector<BracketSummary> summaries;
+    for (const auto& line : lines)
+        summaries.push_back(brackets::summarize(line));
+
+    int mismatches = 0;
+    for (int i = 0; i < 3000; i++)
+    {
+        size_t from = random() % (lines.size() + 1);
+        int64_t start_depth = random() % 4;
+
+        int64_t expected_depth = start_depth;
+        size_t expected = lines.size();
+        for (size_t l = from; l < lines.size(); l++)
+        {
+            if (expected_depth + summaries[l].min_prefix < 0)
+            {
+                expected = l;
+                break;
+            }
+            expected_depth += summaries[l].delta;
+        }
+        int64_t depth = start_depth;
+        if (tree.find_bracket_forward(from, depth) != expected || depth != expected_depth)
+            mismatches++;
+
+        expected_depth = start_depth;
+        expected = lines.size();
+        for (size_t l = from; l-- > 0;)
+        {
+            if (expected_depth + summaries[l].max_suffix >= 1)
+            {
+                expected = l;
+                break;
+            }
+            expected_depth += summaries[l].delta;
+        }
+        depth = start_depth;
+        if (tree.find_bracket_backward(from, depth) != expected || depth != expected_depth)
+            mismatches++;
+    }
+    assertEqual(0, mismatches, "Line tree bracket search test");
+}
+
+// Returns the position the cursor should jump to from the bracket at byte of line, or the same position if it
+// doesn't move, by scanning the text a character at a time.
+std::pair<size_t, size_t> matchingBracket(const std::vector<std::string>& lines, size_t line, size_t byte,
+                                          bool enclosing)
+{
+    std::pair<size_t, size_t> unmoved(line, byte);
+    int change = 0;
+    if (!enclosing)
+    {
+        if (byte >= lines[line].size())
+            return unmoved;
+        change = brackets::depth_change(lines[line][byte]);
+        if (change == 0)
+            return unmoved;
+    }
+
+    int64_t depth = 0;
+    if (change > 0)
+    {
+        size_t at = byte + 1;
+        for (size_t l = line; l < lines.size(); l++, at = 0)
+        {
+            for (; at < lines[l].size(); at++)
+            {
+                depth += brackets::depth_change(lines[l][at]);
+                if (depth < 0)
+                    return {l, at};
+            }
+        }
+        return unmoved;
+    }
+
+    size_t to = byte;
+    for (size_t l = line + 1; l-- > 0;)
+    {
+        if (l != line)
+            to = lines[l].size();
+        while (to-- > 0)
+        {
+            depth -= brackets::depth_change(lines[l][to]);
+            if (depth < 0)
+                return {l, to};
+        }
+    }
+    return unmoved;
+}
+
+std::string joinLines(const std::vector<std::string>& lines)
+{
+    std::string text;
+    for (size_t i = 0; i < lines.size(); i++)
+        text += (i > 0 ? "\n" : "") + lines[i];
+    return text;
+}
+
+std::string documentText(const Document& doc)
+{
+    DocumentSnapshot snapshot = doc.snapshot();
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < snapshot.lines.size(); i++)
+        lines.push_back(snapshot.lines.text(i));
+    return joinLines(lines);
+}
+
+void testBracketJumps()
+{
+    const char* filename = "bracket_jumps_test.txt";
+    writeText(filename, {"int f() {", "    if (a[0]) {", "        g();", "    }", "}"});
+    Document doc(filename);
+    for (int i = 0; i < 8; i++)
+        doc.cursor_right();
+
+    doc.jump_to_matching_bracket();
+    assertEqual(4, (int)doc.cursor_line(), "Jump to matching bracket forward test");
+    assertEqual(0, (int)doc.cursor_column(), "Jump to matching bracket forward test");
+    doc.jump_to_matching_bracket();
+    assertEqual(0, (int)doc.cursor_line(), "Jump to matching bracket backward test");
+    assertEqual(8, (int)doc.cursor_column(), "Jump to matching bracket backward test");
+
+    // Inside g(), the enclosing block is the if, and the one around that is the function
+    doc.jump_to_line(2);
+    doc.cursor_end();
+    doc.jump_to_enclosing_block();
+    assertEqual(1, (int)doc.cursor_line(), "Jump to enclosing block test");
+    assertEqual(14, (int)doc.cursor_column(), "Jump to enclosing block test");
+    doc.jump_to_enclosing_block();
+    assertEqual(0, (int)doc.cursor_line(), "Jump to enclosing block test");
+    assertEqual(8, (int)doc.cursor_column(), "Jump to enclosing block test");
+
+    // Wrapping the call in a new block moves the match of the if's opening brace down a line
+    doc.jump_to_line(2);
+    doc.cursor_end();
+    doc.insert('\n');
+    doc.insert('}');
+    doc.jump_to_line(2);
+    doc.insert('{');
+    doc.insert('\n');
+    doc.jump_to_line(1);
+    doc.cursor_end();
+    doc.cursor_left();
+    doc.jump_to_matching_bracket();
+    assertEqual(5, (int)doc.cursor_line(), "Jump to matching bracket after edits test");
+    assertEqual(4, (int)doc.cursor_column(), "Jump to matching bracket after edits test");
+    doc.jump_to_line(3);
+    doc.cursor_end();
+    doc.jump_to_enclosing_block();
+    assertEqual(2, (int)doc.cursor_line(), "Jump to enclosing block after edits test");
+    assertEqual(0, (int)doc.cursor_column(), "Jump to enclosing block after edits test");
+    std::remove(filename);
+}
+
+// Edits a document holding short lines and one long, indexed line with random keys and checks every bracket jump,
+// and the column the cursor lands on, against a plain scan of a copy of the text edited the same way
+void testBracketJumpsMatchScan()
+{
+    std::mt19937 random(5);
+    std::vector<std::string> lines;
+    for (int i = 0; i < 2000; i++)
+        lines.push_back(randomText(random, i == 1000 ? 70000 : random() % 60, 16));
+    const char* filename = "bracket_fuzz_test.txt";
+    {
+        std::ofstream file(filename, std::ios::binary);
+        file << joinLines(lines);
+    }
+    Document doc(filename);
+
+    int mismatches = 0;
+    for (int step = 0; step < 3000; step++)
+    {
+        size_t line = doc.cursor_line();
+        size_t byte = byteOfColumn(lines[line], doc.cursor_column());
+        int action = random() % 10;
+        if (action < 4)
+        {
+            bool enclosing = action == 3;
+            auto expected = matchingBracket(lines, line, byte, enclosing);
+            if (enclosing)
+                doc.jump_to_enclosing_block();
+            else
+                doc.jump_to_matching_bracket();
+            if (doc.cursor_line() != expected.first ||
+                doc.cursor_column() != columnOfByte(lines[expected.first], expected.second))
+                mismatches++;
+        }
+        else if (action < 6)
+        {
+            char ch = "{}[]()a\n"[random() % 8];
+            doc.insert(ch);
+            if (ch == '\n')
+            {
+                lines.insert(lines.begin() + line + 1, lines[line].substr(byte));
+                lines[line].erase(byte);
+            }
+            else
+            {
+                lines[line].insert(byte, 1, ch);
+            }
+        }
+        else if (action == 6)
+        {
+            doc.delete_backward();
+            if (byte > 0)
+            {
+                size_t start = byteOfColumn(lines[line], doc.cursor_column());
+                lines[line].erase(start, byte - start);
+            }
+            else if (line > 0)
+            {
+                lines[line - 1] += lines[line];
+                lines.erase(lines.begin() + line);
+            }
+        }
+        else if (action == 7)
+        {
+            // Often go to the long line, so that its block index is searched too
+            auto longest = std::max_element(lines.begin(), lines.end(),
+                                            [](const std::string& a, const std::string& b) { return a.size() < b.size(); });
+            doc.jump_to_line(random() % 4 == 0 ? longest - lines.begin() : random() % lines.size());
+            for (size_t i = random() % 40; i > 0; i--)
+                doc.cursor_right();
+        }
+        else
+        {
+            switch (random() % 4)
+            {
+            case 0:
+                doc.cursor_up();
+                break;
+            case 1:
+                doc.cursor_down();
+                break;
+            case 2:
+                doc.cursor_end();
+                break;
+            default:
+                doc.cursor_left();
+                break;
+            }
+        }
+    }
+    assertEqual(0, mismatches, "Bracket jumps match scan test");
+    assertEqual(joinLines(lines), documentText(doc), "Bracket jumps match scan text test");
+    std::remove(filename);
+}
+
+// A task blocks its worker until the tasks it submitted have run. They go to its own worker's queue, so they can
+// only run if the other workers steal them.
+void testThreadPoolStealing()
+{
+    std::mutex mutex;
+    std::condition_variable done;
+    int finished = 0;
+    int stolen = 0;
+    std::promise<bool> parent_result;
+    ThreadPool pool(4);
+
+    pool.submit([&] {
+        auto parent = std::this_thread::get_id();
+        for (int i = 0; i < 3; i++)
+        {
+            pool.submit([&, parent] {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished++;
+                if (std::this_thread::get_id() != parent)
+                    stolen++;
+                done.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        parent_result.set_value(done.wait_for(lock, std::chrono::seconds(5), [&] { return finished == 3; }));
+    });
+
+    bool all_finished = parent_result.get_future().get();
+    std::lock_guard<std::mutex> lock(mutex);
+    assertEqual(1, all_finished, "Thread pool stealing test");
+    assertEqual(3, stolen, "Thread pool stealing test");
+}
+
+// Submits from several threads at once, and from inside tasks, so that workers race for each other's tasks. Every
+// task must run without waiting for a later submission to wake a worker.
+void testThreadPoolRunsEveryTask()
+{
+    const int submitters = 4;
+    const int tasks_each = 20000;
+    std::atomic<int> finished{0};
+    ThreadPool pool(4);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < submitters; t++)
+    {
+        threads.emplace_back([&] {
+            for (int i = 0; i < tasks_each; i++)
+            {
+                if (i % 2 == 0)
+                    pool.submit([&] { finished++; });
+                else
+                    pool.submit([&] { pool.submit([&] { finished += 2; }); });
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (finished < submitters * tasks_each * 3 / 2 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    assertEqual(submitters * tasks_each * 3 / 2, finished, "Thread pool runs every task test");
+}
+
+// Only the job which is neither cancelled nor overtaken by a version change may deliver its result.
+void testRunInBackground()
+{
+    EventLoop loop;
+    uint64_t version = 1;
+    auto current_version = [&] { return version; };
+    std::atomic<int> worked{0};
+    std::vector<int> applied;
+    auto apply = [&](int& result) { applied.push_back(result); };
+
+    // Declared last so that its workers are joined before anything they use goes away
+    ThreadPool pool(2);
+
+    // Cancelled before it starts, so the work never runs
+    CancellationToken cancelled;
+    cancelled.cancel();
+    run_in_background<int>(
+        pool, loop, cancelled, current_version,
+        [&](const CancellationToken&) {
+            worked++;
+            return 1;
+        },
+        apply);
+
+    // Submitted against a version which is then replaced, so the result is dropped on the loop thread
+    run_in_background<int>(
+        pool, loop, CancellationToken(), current_version,
+        [&](const CancellationToken&) {
+            worked++;
+            return 2;
+        },
+        apply);
+    version++;
+
+    // Cancelled while it runs
+    CancellationToken interrupted;
+    std::promise<void> started;
+    run_in_background<int>(
+        pool, loop, interrupted, current_version,
+        [&](const CancellationToken& token) {
+            started.set_value();
+            while (!token.cancelled())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            worked++;
+            return 3;
+        },
+        apply);
+    started.get_future().wait();
+    interrupted.cancel();
+
+    run_in_background<int>(
+        pool, loop, CancellationToken(), current_version,
+        [&](const CancellationToken&) {
+            worked++;
+            return 4;
+        },
+        apply);
+
+    // Results are posted as soon as the work returns, so a short wait afterwards lets every one reach the loop
+    while (worked < 3)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    loop.add_timer(std::chrono::milliseconds(100), [&] { loop.stop(); });
+    loop.run();
+
+    assertEqual(3, worked, "Run in background test");
+    assertEqual(1, (int)applied.size(), "Run in background test");
+    assertEqual(4, applied.empty() ? 0 : applied.front(), "Run in background test");
+}
+
+void waitForIndex(const PagedFile& file)
+{
+    while (!file.indexed())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// Writes lines of the given lengths and returns the offset at which each one starts. With from, the first from lines
+// are taken to be in the file already and the rest are appended.
+std::vector<uint64_t> writeLines(const char* filename, const std::vector<size_t>& lengths, size_t from = 0)
+{
+    std::vector<uint64_t> starts;
+    std::ofstream file(filename, from > 0 ? std::ios::binary | std::ios::app : std::ios::binary);
+    uint64_t offset = 0;
+    for (size_t i = 0; i < lengths.size(); i++)
+    {
+        starts.push_back(offset);
+        if (i >= from)
+            file << std::string(lengths[i], 'a' + i % 26) << '\n';
+        offset += lengths[i] + 1;
+    }
+    return starts;
+}
+
+// Checks line lookups in paged mode against the line starts of the file, with a cache of only two pages so that
+// most lookups evict one
+void testPagedFileLines()
+{
+    const char* filename = "paged_file_test.txt";
+    std::vector<size_t> lengths;
+    for (size_t i = 0; i < 5000; i++)
+        lengths.push_back(i % 200);
+    std::vector<uint64_t> starts = writeLines(filename, lengths);
+
+    PagedFile file(filename, 2 * PagedFile::PAGE_BYTES);
+    waitForIndex(file);
+
+    int mismatches = 0;
+    size_t most_pages = 0;
+    std::mt19937 random(3);
+    for (int i = 0; i < 2000; i++)
+    {
+        size_t line = random() % starts.size();
+        if (file.offset_of_line(line) != starts[line])
+            mismatches++;
+        if (file.line_start(starts[line] + line % 200) != starts[line])
+            mismatches++;
+        if (file.prev_line(starts[line]) != starts[line > 0 ? line - 1 : 0])
+            mismatches++;
+        most_pages = std::max(most_pages, file.resident_pages());
+    }
+    if (file.offset_of_line(starts.size() + 10) != starts.back())
+        mismatches++;
+
+    assertEqual(0, mismatches, "Paged file line lookup test");
+    assertEqual(2, (int)most_pages, "Paged file page cap test");
+    std::remove(filename);
+}
+
+int countLineMismatches(PagedFile& file, const std::vector<uint64_t>& starts)
+{
+    // Each lookup walks up to a checkpoint's worth of lines, so sample about a thousand of them
+    int mismatches = 0;
+    for (size_t line = 0; line < starts.size(); line += 7 + starts.size() / 1000)
+    {
+        if (file.offset_of_line(line) != starts[line])
+            mismatches++;
+    }
+    if (file.offset_of_line(starts.size() - 1) != starts.back())
+        mismatches++;
+    return mismatches;
+}
+
+// Reopens a file after it was left unchanged, grew and was changed in place, checking that the saved line index is
+// used as it is, extended from the old end of the file and thrown away respectively
+void testIndexCache()
+{
+    const char* filename = "index_cache_test.txt";
+    std::vector<size_t> lengths;
+    for (size_t i = 0; i < 5000; i++)
+        lengths.push_back(i * 37 % 200);
+    std::vector<uint64_t> starts = writeLines(filename, lengths);
+
+    {
+        PagedFile file(filename, 4 * PagedFile::PAGE_BYTES);
+        assertEqual(0, (int)file.index_scan_start(), "Index cache first open test");
+        waitForIndex(file);
+    }
+
+    uint64_t size = starts.back() + lengths.back() + 1;
+    {
+        PagedFile file(filename, 4 * PagedFile::PAGE_BYTES);
+        assertEqual(1, file.indexed(), "Index cache unchanged test");
+        assertEqual((int)size, (int)file.index_scan_start(), "Index cache unchanged test");
+        assertEqual(0, countLineMismatches(file, starts), "Index cache unchanged test");
+    }
+
+    for (size_t i = 0; i < 3000; i++)
+        lengths.push_back(i * 53 % 200);
+    starts = writeLines(filename, lengths);
+    {
+        PagedFile file(filename, 4 * PagedFile::PAGE_BYTES);
+        assertEqual((int)size, (int)file.index_scan_start(), "Index cache grown test");
+        waitForIndex(file);
+        assertEqual(0, countLineMismatches(file, starts), "Index cache grown test");
+    }
+
+    // Swapping the lengths of two lines away from the hashed head and tail keeps the size, but moves a line start
+    size_t middle = lengths.size() / 2;
+    while (lengths[middle] == lengths[middle + 1])
+        middle++;
+    std::swap(lengths[middle], lengths[middle + 1]);
+    auto modified = std::filesystem::last_write_time(filename);
+    starts = writeLines(filename, lengths);
+    std::filesystem::last_write_time(filename, modified + std::chrono::seconds(1));
+    {
+        PagedFile file(filename, 4 * PagedFile::PAGE_BYTES);
+        assertEqual(0, (int)file.index_scan_start(), "Index cache changed test");
+        waitForIndex(file);
+        assertEqual(0, countLineMismatches(file, starts), "Index cache changed test");
+    }
+
+    // Lines appended while the first index is still being built must be left to the next open, which resumes from
+    // the size the file had when the index was started
+    lengths.clear();
+    for (size_t i = 0; i < 200000; i++)
+        lengths.push_back(i * 37 % 200);
+    starts = writeLines(filename, lengths);
+    size = starts.back() + lengths.back() + 1;
+    {
+        PagedFile file(filename, 4 * PagedFile::PAGE_BYTES);
+        size_t appended = lengths.size();
+        for (size_t i = 0; i < 500; i++)
+            lengths.push_back(i % 90);
+        writeLines(filename, lengths, appended);
+        waitForIndex(file);
+    }
+    size_t appended = lengths.size();
+    for (size_t i = 0; i < 5000; i++)
+        lengths.push_back(i % 70);
+    starts = writeLines(filename, lengths, appended);
+    {
+        PagedFile file(filename, 4 * PagedFile::PAGE_BYTES);
+        assertEqual((int)size, (int)file.index_scan_start(), "Index cache appended during indexing test");
+        waitForIndex(file);
+        assertEqual(0, countLineMismatches(file, starts), "Index cache appended during indexing test");
+    }
+    std::remove(filename);
+}
+
+// Applies hunks from diff_lines to old_lines, checking that they are in order and don't overlap.
+std::vector<std::string_view> applyHunks(const std::vector<std::string_view>& old_lines,
+                                         const std::vector<std::string_view>& new_lines,
+                                         const std::vector<DiffHunk>& hunks, bool& ordered)
+{
+    std::vector<std::string_view> result;
+    size_t old_line = 0;
+    ordered = true;
+    for (const auto& hunk : hunks)
+    {
+        if (hunk.old_start < old_line || hunk.new_start != result.size() + hunk.old_start - old_line)
+            ordered = false;
+        while (old_line < hunk.old_start && old_line < old_lines.size())
+            result.push_back(old_lines[old_line++]);
+        for (size_t i = 0; i < hunk.new_count; i++)
+            result.push_back(new_lines[hunk.new_start + i]);
+        old_line += hunk.old_count;
+    }
+    while (old_line < old_lines.size())
+        result.push_back(old_lines[old_line++]);
+    return result;
+}
+
+void testDiffLines()
+{
+    std::vector<std::string_view> old_lines = {"a", "b", "c", "d", "e"};
+    std::vector<std::string_view> new_lines = {"a", "x", "c", "d", "e", "f"};
+    CancellationToken token;
+
+    assertEqual(0, (int)diff_lines(old_lines, old_lines, token).size(), "Diff identical lines test");
+
+    auto hunks = diff_lines(old_lines, new_lines, token);
+    bool exact = hunks.size() == 2 && hunks[0].old_start == 1 && hunks[0].old_count == 1 && hunks[0].new_start == 1 &&
+                 hunks[0].new_count == 1 && hunks[1].old_start == 5 && hunks[1].old_count == 0 &&
+                 hunks[1].new_start == 5 && hunks[1].new_count == 1;
+    assertEqual(1, exact, "Diff minimal hunks test");
+
+    // Random edits of a random text; the hunks must turn the old lines into the new ones
+    std::mt19937 random(11);
+    const std::string_view words[] = {"alpha", "beta", "gamma", "delta"};
+    int mismatches = 0;
+    for (int round = 0; round < 200; round++)
+    {
+        std::vector<std::string_view> before;
+        for (size_t i = random() % 60; i > 0; i--)
+            before.push_back(words[random() % 4]);
+        std::vector<std::string_view> after = before;
+        for (size_t i = random() % 8; i > 0; i--)
+        {
+            size_t at = after.empty() ? 0 : random() % (after.size() + 1);
+            if (random() % 2 == 0 && at < after.size())
+                after.erase(after.begin() + at);
+            else
+                after.insert(after.begin() + at, words[random() % 4]);
+        }
+
+        bool ordered;
+        if (applyHunks(before, after, diff_lines(before, after, token), ordered) != after || !ordered)
+            mismatches++;
+    }
+    assertEqual(0, mismatches, "Diff random edits test");
+
+    // The hunks are minimal: they touch as many lines as the shortest script, found by dynamic programming
+    mismatches = 0;
+    for (int round = 0; round < 200; round++)
+    {
+        std::vector<std::string_view> before;
+        std::vector<std::string_view> after;
+        for (size_t i = random() % 30; i > 0; i--)
+            before.push_back(words[random() % 4]);
+        for (size_t i = random() % 30; i > 0; i--)
+            after.push_back(words[random() % 4]);
+
+        std::vector<std::vector<size_t>> distance(before.size() + 1, std::vector<size_t>(after.size() + 1));
+        for (size_t i = 0; i <= before.size(); i++)
+        {
+            for (size_t j = 0; j <= after.size(); j++)
+            {
+                if (i == 0 || j == 0)
+                    distance[i][j] = i + j;
+                else if (before[i - 1] == after[j - 1])
+                    distance[i][j] = distance[i - 1][j - 1];
+                else
+                    distance[i][j] = std::min(distance[i - 1][j], distance[i][j - 1]) + 1;
+            }
+        }
+
+        size_t touched = 0;
+        for (const auto& hunk : diff_lines(before, after, token))
+            touched += hunk.old_count + hunk.new_count;
+        if (touched != distance[before.size()][after.size()])
+            mismatches++;
+    }
+    assertEqual(0, mismatches, "Diff minimal random test");
+
+    // Thousands of scattered edits still give one hunk per edit rather than one covering them all
+    std::vector<std::string> numbered;
+    for (int i = 0; i < 16000; i++)
+        numbered.push_back("line " + std::to_string(i));
+    std::vector<std::string_view> before(numbered.begin(), numbered.begin() + 8000);
+    std::vector<std::string_view> after;
+    size_t edits = 0;
+    for (size_t i = 0; i < before.size(); i++)
+    {
+        if (i % 5 == 2)
+        {
+            after.push_back(numbered[8000 + i]);
+            edits += 2;
+        }
+        else
+        {
+            after.push_back(before[i]);
+        }
+    }
+    hunks = diff_lines(before, after, token);
+    size_t touched = 0;
+    for (const auto& hunk : hunks)
+        touched += hunk.old_count + hunk.new_count;
+    bool ordered;
+    assertEqual(1, applyHunks(before, after, hunks, ordered) == after && ordered, "Diff many edits test");
+    assertEqual((int)edits, (int)touched, "Diff many edits test");
+    assertEqual((int)(edits / 2), (int)hunks.size(), "Diff many edits test");
+
+    CancellationToken cancelled;
+    cancelled.cancel();
+    assertEqual(0, (int)diff_lines(old_lines, new_lines, cancelled).size(), "Diff cancelled test");
+}
+
+// Reloads a file changed around and under the cursor, which must stay on the text it was on, with the view
+// scrolled by the lines inserted and deleted above it
+void testApplyReload()
+{
+    // The view height decides the scroll position, so give the document a screen that draws nowhere
+    FILE* output = fopen("/dev/null", "w");
+    FILE* input = fopen("/dev/null", "r");
+    SCREEN* screen = newterm("xterm", output, input);
+    if (!screen)
+    {
+        std::cout << "Apply reload test: Skipped, no xterm terminfo\n";
+        fclose(output);
+        fclose(input);
+        return;
+    }
+
+    const char* filename = "reload_test.txt";
+    std::vector<std::string> text;
+    for (int i = 0; i < 100; i++)
+        text.push_back("line " + std::to_string(i));
+    writeText(filename, text);
+
+    Document doc(filename);
+    for (int i = 0; i < 50; i++)
+        doc.cursor_down();
+    for (int i = 0; i < 3; i++)
+        doc.cursor_right();
+    size_t top = doc.top_line();
+    uint64_t version = doc.version();
+
+    // Five lines inserted at the top and one deleted above the cursor move it down by four
+    text.erase(text.begin() + 10);
+    text.insert(text.begin(), 5, "new");
+    writeText(filename, text);
+    doc.apply_reload(Document::plan_reload(filename, doc.snapshot(), CancellationToken()));
+    assertEqual(54, (int)doc.cursor_line(), "Apply reload moves cursor test");
+    assertEqual(3, (int)doc.cursor_column(), "Apply reload moves cursor test");
+    assertEqual("line 50", currentLine(doc), "Apply reload moves cursor test");
+    assertEqual((int)top + 4, (int)doc.top_line(), "Apply reload moves view test");
+    assertEqual(1, doc.version() != version, "Apply reload version test");
+
+    // Rewriting the cursor line keeps the cursor on its replacement, clamped to its length
+    text[54] = "ab";
+    writeText(filename, text);
+    doc.apply_reload(Document::plan_reload(filename, doc.snapshot(), CancellationToken()));
+    assertEqual(54, (int)doc.cursor_line(), "Apply reload replaced line test");
+    assertEqual(2, (int)doc.cursor_column(), "Apply reload replaced line test");
+    assertEqual("ab", currentLine(doc), "Apply reload replaced line test");
+
+    // Deleting the lines from the cursor to the end leaves it on the new last line
+    text.resize(54);
+    writeText(filename, text);
+    doc.apply_reload(Document::plan_reload(filename, doc.snapshot(), CancellationToken()));
+    assertEqual(53, (int)doc.cursor_line(), "Apply reload deleted line test");
+    assertEqual("line 49", currentLine(doc), "Apply reload deleted line test");
+
+    // An unchanged file is not an edit
+    version = doc.version();
+    doc.apply_reload(Document::plan_reload(filename, doc.snapshot(), CancellationToken()));
+    assertEqual(1, doc.version() == version, "Apply reload unchanged test");
+
+    endwin();
+    delscreen(screen);
+    fclose(output);
+    fclose(input);
+    std::remove(filename);
+}
+
+void benchLoadTeardown()
+{
+    const char* filename = "bench_load.txt";
+    {
+        std::ofstream file(filename);
+        for (int i = 0; i < 1000000; i++)
+            file << "line " << i << " of the load and teardown benchmark\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t allocations = allocation_count;
+    auto doc = new Document(filename);
+    size_t load_allocations = allocation_count - allocations;
+    auto loaded = std::chrono::steady_clock::now();
+    delete doc;
+    auto destroyed = std::chrono::steady_clock::now();
+
+    std::cout << "Load 1M lines: " << load_allocations << " allocations, "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(loaded - start).count() << " ms\n";
+    std::cout << "Teardown 1M lines: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(destroyed - loaded).count() << " ms\n";
+    std::remove(filename);
 }
 
 void runTests()
@@ -179,10 +1361,33 @@ void runTests()
 
     testCursorRightEndOfDocument();
     testCursorRightEndOfLine();
+    testJumpToPercent();
+
+    testSnapshotConcurrentReaders();
+    testSnapshotEditedOnWorker();
+    testBracketBlocksMatchScan();
+    testLongLineEdits();
+    testLineTreeBracketSearch();
+    testBracketJumps();
+    testBracketJumpsMatchScan();
+    testPagedFileLines();
+    testIndexCache();
+    testDiffLines();
+    testApplyReload();
+    testThreadPoolStealing();
+    testThreadPoolRunsEveryTask();
+    testRunInBackground();
 }
 
 int main()
 {
+    // Keep the line indexes saved by the paged file tests out of the user's cache
+    char cache_dir[] = "/tmp/te_tests.XXXXXX";
+    if (mkdtemp(cache_dir))
+        setenv("XDG_CACHE_HOME", cache_dir, 1);
+
     runTests();
-    return 0;
+    benchLoadTeardown();
+    std::filesystem::remove_all(cache_dir);
+    return failures == 0 ? 0 : 1;
 }
\ No newline at end of file
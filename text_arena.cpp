@@ -0,0 +1,46 @@
+#include "text_arena.h"
+#include <algorithm>
+#include <cstring>
+
+// Size of a regular chunk; larger requests get a chunk of their own
+static const size_t CHUNK_BYTES = 64 * 1024;
+
+char* TextArena::allocate(size_t size)
+{
+    if (size > remaining)
+    {
+        size_t chunk_size = std::max(size, CHUNK_BYTES);
+        chunks.emplace_back(new char[chunk_size]); // deliberately not zero-filled
+
+        // Keep filling the current chunk if the new one was only for an oversized request
+        if (size >= CHUNK_BYTES && remaining > 0)
+        {
+            used_bytes += size;
+            return chunks.back().get();
+        }
+        next = chunks.back().get();
+        remaining = chunk_size;
+    }
+
+    char* result = next;
+    next += size;
+    remaining -= size;
+    used_bytes += size;
+    return result;
+}
+
+std::string_view TextArena::store(std::string_view text)
+{
+    // An empty arena has no chunk to point into, and there is nothing to copy anyway
+    if (text.empty())
+        return {};
+
+    char* copy = allocate(text.size());
+    memcpy(copy, text.data(), text.size());
+    return {copy, text.size()};
+}
+
+size_t TextArena::used() const
+{
+    return used_bytes;
+}
@@ -0,0 +1,33 @@
+#ifndef TEXT_ARENA_H
+#define TEXT_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Append-only storage for line text. Memory is handed out from large chunks which are only released, all at once,
+// when the arena is destroyed. Stored text never moves, so views into it stay valid for the arena's lifetime.
+class TextArena
+{
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* next = nullptr;
+    size_t remaining = 0;
+    size_t used_bytes = 0;
+
+  public:
+    TextArena() = default;
+    TextArena(const TextArena&) = delete;
+    TextArena& operator=(const TextArena&) = delete;
+
+    // Returns uninitialised space for size bytes.
+    char* allocate(size_t size);
+
+    // Copies text into the arena and returns a view of the copy.
+    std::string_view store(std::string_view text);
+
+    // Total number of bytes handed out, including those of text that is no longer referenced.
+    size_t used() const;
+};
+
+#endif
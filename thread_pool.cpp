@@ -0,0 +1,111 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+// Index of the queue owned by the current thread, or -1 outside the pool
+static thread_local int current_queue = -1;
+static thread_local const ThreadPool* current_pool = nullptr;
+
+CancellationToken::CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false))
+{
+}
+
+void CancellationToken::cancel() const
+{
+    flag->store(true);
+}
+
+bool CancellationToken::cancelled() const
+{
+    return flag->load();
+}
+
+ThreadPool::ThreadPool(size_t thread_count)
+{
+    thread_count = std::max<size_t>(1, thread_count);
+    for (size_t i = 0; i < thread_count; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < thread_count; i++)
+        threads.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    // Keep work spawned by a task on the same worker, otherwise spread submissions round robin
+    size_t index = current_pool == this ? current_queue : next_queue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        pending++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::worker_loop(size_t index)
+{
+    current_queue = index;
+    current_pool = this;
+
+    while (true)
+    {
+        // Claim one of the pending tasks. Every claim is backed by a task already in some queue, but a single pass
+        // over the queues can miss it: the task we were heading for may be taken by another worker while ours is
+        // pushed to a queue we have already looked at. So search until it turns up rather than dropping the claim.
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping)
+                return;
+            pending--;
+        }
+
+        std::function<void()> task;
+        while (!take_task(index, task))
+            std::this_thread::yield();
+        task();
+    }
+}
+
+bool ThreadPool::take_task(size_t index, std::function<void()>& task)
+{
+    // Newest task from our own queue first, since its data is most likely still in cache
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Otherwise steal the oldest task from another worker
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        Queue& other = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
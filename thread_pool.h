@@ -0,0 +1,56 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared flag used to ask a background task to give up early. Copies refer to the same flag.
+class CancellationToken
+{
+    std::shared_ptr<std::atomic<bool>> flag;
+
+  public:
+    CancellationToken();
+    void cancel() const;
+    bool cancelled() const;
+};
+
+// Fixed size pool of worker threads. Each worker has its own task queue; tasks submitted from a worker go to that
+// worker's queue, and idle workers steal from the other queues.
+class ThreadPool
+{
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_queue{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    size_t pending = 0;
+    bool stopping = false;
+
+  public:
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+  private:
+    void worker_loop(size_t index);
+    bool take_task(size_t index, std::function<void()>& task);
+};
+
+#endif
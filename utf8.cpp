@@ -18,7 +18,7 @@ int utf8::char_length(char c)
     return utf8_length_table[(unsigned char)c];
 }
 
-std::string utf8::substr(const std::string& str, std::size_t start, std::size_t len)
+std::string utf8::substr(std::string_view str, std::size_t start, std::size_t len)
 {
     std::size_t str_len = str.length();
     std::size_t i = 0;
@@ -42,10 +42,10 @@ std::string utf8::substr(const std::string& str, std::size_t start, std::size_t
         i += 1;
     }
 
-    return str.substr(start_byte, end_byte - start_byte);
+    return std::string(str.substr(start_byte, end_byte - start_byte));
 }
 
-int utf8::str_length(const std::string& str)
+int utf8::str_length(std::string_view str)
 {
     int length = 0;
     for (size_t i = 0; i < str.size(); )
@@ -56,13 +56,13 @@ int utf8::str_length(const std::string& str)
     return length;
 }
 
-std::wstring utf8::to_wide_char(const std::string& str)
+std::wstring utf8::to_wide_char(std::string_view str)
 {
     std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    return converter.from_bytes(str);
+    return converter.from_bytes(str.data(), str.data() + str.size());
 }
 
-int utf8::terminal_to_char_index(const std::string& str, int terminal_index)
+int utf8::terminal_to_char_index(std::string_view str, int terminal_index)
 {
     int term_count = 0;
     int char_index = 0;
@@ -79,7 +79,7 @@ int utf8::terminal_to_char_index(const std::string& str, int terminal_index)
     return (term_count > terminal_index) ? char_index - 1 : char_index;
 }
 
-std::string utf8::char_to_unicode(const std::string& str)
+std::string utf8::char_to_unicode(std::string_view str)
 {
     if (str.empty())
         return "";